@@ -0,0 +1,140 @@
+//
+// Evolve the sqrt problem on an evaluation farm.
+//
+//     farm serve ADDRESS   run an evaluator node listening on ADDRESS
+//     farm ADDRESS...      evolve, scoring programs on the nodes at ADDRESS...
+//     farm                 start local evaluator nodes on Unix sockets,
+//                          evolve on them, and kill one halfway through
+//
+// Addresses are `unix:PATH` or `HOST:PORT`.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "gp.h"
+#include <math.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_SIZE 200
+#define NUM_LOCAL 4
+#define STEPS 100000
+
+static gp_num_t constant_func(void)
+{
+	return rand_num() * 10 - 5;
+}
+
+// Every node must build the same config and data
+static GpWorldConf make_conf(GpDataset * dataset)
+{
+	for (uint i = 0; i < TEST_SIZE; i++) {
+		gp_num_t * row = gp_dataset_row(dataset, i);
+		row[0] = i * 50.0;
+		row[1] = sqrt(row[0]);
+	}
+
+	GpWorldConf conf = gp_world_conf_default();
+	conf.constant_func      = &constant_func;
+	conf.dataset            = dataset;
+	conf.population_size    = 1000;
+	conf.num_inputs         = 1;
+	conf.min_program_length = 5;
+	conf.max_program_length = 30;
+	conf.minimize_fitness   = 1;
+	return conf;
+}
+
+static void serve(const char * address)
+{
+	GpDataset * dataset = gp_dataset_new(1, TEST_SIZE);
+	GpWorldConf conf = make_conf(dataset);
+	conf.population_size = 2;
+
+	GpWorld * world = gp_world_new();
+	gp_world_initialize(world, conf);
+	gp_farm_serve(world, address);
+}
+
+static void evolve(const char * workers, pid_t victim)
+{
+	GpDataset * dataset = gp_dataset_new(1, TEST_SIZE);
+	GpWorldConf conf = make_conf(dataset);
+	conf.farm_workers = workers;
+
+	// Offspring of a batch of tournaments travel to the nodes together
+	conf.tournament_batch = 32;
+
+	GpWorld * world = gp_world_new();
+	gp_world_initialize(world, conf);
+
+	gp_world_evolve_times(world, STEPS / 2);
+	if (victim > 0) {
+		printf("Killing one evaluator node\n");
+		kill(victim, SIGKILL);
+	}
+	gp_world_evolve_times(world, STEPS / 2);
+
+	printf("Best fitness:  %f\n", world->stats.best_fitness);
+	printf("Reassigned:    %u\n", world->stats.farm_reassigned);
+	printf("Scored here:   %u\n", world->stats.farm_local);
+
+	gp_world_delete(world);
+	gp_dataset_delete(dataset);
+}
+
+int main(int argc, char ** argv)
+{
+	uint i;
+
+	if (argc == 3 && strcmp(argv[1], "serve") == 0) {
+		serve(argv[2]);
+		return 0;
+	}
+
+	if (argc > 1)
+	{
+		char workers[4096] = "";
+		for (i = 1; i < (uint)argc; i++) {
+			strncat(workers, argv[i], sizeof(workers) - strlen(workers) - 2);
+			if (i + 1 < (uint)argc)
+				strcat(workers, ",");
+		}
+		evolve(workers, 0);
+		return 0;
+	}
+
+	// Stand-in evaluator nodes, each in its own process on this machine
+	char addresses[NUM_LOCAL][64];
+	char workers[NUM_LOCAL * 64] = "";
+	pid_t pids[NUM_LOCAL];
+
+	for (i = 0; i < NUM_LOCAL; i++)
+	{
+		snprintf(addresses[i], sizeof(addresses[i]), "unix:/tmp/libgp-farm-%ld-%u", (long)getpid(), i);
+		if (i > 0)
+			strcat(workers, ",");
+		strcat(workers, addresses[i]);
+
+		if ((pids[i] = fork()) == 0)
+			serve(addresses[i]);
+	}
+
+	// Wait for the nodes to listen
+	const struct timespec ms = { 0, 1000000 };
+	for (i = 0; i < NUM_LOCAL; i++)
+		while (access(addresses[i] + 5, F_OK) != 0)
+			nanosleep(&ms, NULL);
+
+	evolve(workers, pids[0]);
+
+	for (i = 0; i < NUM_LOCAL; i++) {
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+		unlink(addresses[i] + 5);
+	}
+	return 0;
+}
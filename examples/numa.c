@@ -0,0 +1,91 @@
+//
+// Compare the NUMA placement modes on the sqrt problem: how fast each one
+// evolves on every CPU, how many of the workers' draws stay on their own
+// node, and how many of each node's statement pages really are in its
+// memory.
+//
+
+#include "gp.h"
+#include <math.h>
+
+#define TEST_SIZE 200
+#define SECS 5
+
+static gp_num_t constant_func(void)
+{
+	return rand_num() * 10 - 5;
+}
+
+// The node whose range of ids `id` falls in
+static uint owner(uint id, uint popsize, uint nodes)
+{
+	uint k = nodes - 1;
+	while ((unsigned long long)k * popsize / nodes > id)
+		k--;
+	return k;
+}
+
+// Percentage of the population's statements on the node owning them,
+// checking the first statement of every program
+static float placed(GpWorld * world, uint nodes)
+{
+	const uint popsize = world->conf.population_size;
+	uint on_node = 0;
+	for (uint i = 0; i < popsize; i++) {
+		const GpProgram * program = world->programs + i;
+		if (gp_numa_node_of(program->stmts) == (int)owner(program->id, popsize, nodes))
+			on_node++;
+	}
+	return 100.0 * on_node / popsize;
+}
+
+int main(void)
+{
+	// rand_num doesn't work until first world is initialized :(
+	gp_world_delete(gp_world_new());
+
+	GpDataset * dataset = gp_dataset_new(1, TEST_SIZE);
+	for (uint i = 0; i < TEST_SIZE; i++) {
+		gp_num_t * row = gp_dataset_row(dataset, i);
+		row[0] = rand_num() * 10000;
+		row[1] = sqrt(row[0]);
+	}
+
+	GpWorldConf conf = gp_world_conf_default();
+	conf.constant_func      = &constant_func;
+	conf.dataset            = dataset;
+	conf.population_size    = 100000;
+	conf.num_inputs         = 1;
+	conf.min_program_length = 5;
+	conf.max_program_length = 30;
+	conf.minimize_fitness   = 1;
+
+	const GpNumaMode modes[] = { GP_NUMA_OFF, GP_NUMA_FIRST_TOUCH, GP_NUMA_BIND };
+	const char * names[] = { "off", "first touch", "bind" };
+	const uint nodes = gp_numa_num_nodes();
+
+	printf("%u NUMA node(s), %d seconds per mode\n\n", nodes, SECS);
+	printf("%-12s  %-12s  %8s  %8s  %8s\n", "Mode", "Steps/sec", "Local", "Remote", "Placed");
+
+	for (uint m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+	{
+		conf.numa = modes[m];
+
+		GpWorld * world = gp_world_new();
+		gp_world_initialize(world, conf);
+		const uint steps = gp_world_evolve_secs_parallel(world, SECS);
+
+		const float draws = world->stats.numa_local + world->stats.numa_remote;
+		printf("%-12s  %-12.0f  %7.2f%%  %7.2f%%  %7.2f%%\n",
+			names[m],
+			(float)steps / SECS,
+			draws > 0 ? 100 * world->stats.numa_local / draws : 0,
+			draws > 0 ? 100 * world->stats.numa_remote / draws : 0,
+			placed(world, nodes));
+
+		gp_world_delete(world);
+	}
+
+	gp_dataset_delete(dataset);
+	return 0;
+}
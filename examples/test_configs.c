@@ -61,6 +61,12 @@ int main(void)
 	default_conf.minimize_fitness   = 1;
 	default_conf.mutate_rate        = 0.4;
 
+	// Counter mode must give the same population on any number of threads
+	GpWorldConf perf_conf = default_conf;
+	perf_conf.num_threads = 4;
+	if (!gp_test_performance(perf_conf, 200000))
+		return 1;
+
 	GpWorldConf confs[4];
 	confs[0] = confs[1] = confs[2] = confs[3] = default_conf;
 
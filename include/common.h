@@ -31,7 +31,75 @@ typedef double gp_fitness_t;
 #define SFMT_MEXP 19937
 #include "SFMT.h"
 
-extern sfmt_t _sfmt;
+// Number of values generated in each block. SFMT needs a multiple of 4
+// that is at least `SFMT_N32`.
+#define GP_RAND_BUFFER 1024
+
+// Number of values generated in each block by a counter-based engine.
+// Its streams are short, so it only computes a few values ahead.
+#define GP_RAND_COUNTER_BLOCK 16
+
+typedef enum {
+	GP_RAND_SFMT = 0,
+	GP_RAND_COUNTER
+} GpRandMode;
+
+//
+// A random number engine. In SFMT mode, SFMT fills `buf` a whole block at
+// a time with its SIMD generator, and values are handed out from it one by
+// one.
+//
+// In counter mode, values are instead computed by the Philox4x32-10 block
+// cipher from the key and a counter. `gp_rand_stream` picks the stream
+// that later draws come from, so a value depends only on which stream it
+// was drawn from and its position there, not on what ran before it.
+//
+typedef struct {
+	sfmt_t sfmt;
+	uint32_t buf[GP_RAND_BUFFER] __attribute__((aligned(16)));
+	uint pos;
+	uint end;
+	GpRandMode mode;
+	uint32_t key;
+	uint32_t ctr[4];
+} GpRand;
+
+// The generator used before any world is initialized
+extern GpRand _gp_rand;
+
+// The generator used by the calling thread. Each world has its own, which
+// its evolve functions switch to, and worker threads each have their own.
+extern __thread GpRand * _gp_rng;
+
+void gp_rand_seed (GpRand *, uint32_t, GpRandMode);
+void gp_rand_fill (GpRand *);
+
+static inline uint32_t gp_rand_next(GpRand * rng)
+{
+	if (gp_unlikely(rng->pos == rng->end))
+		gp_rand_fill(rng);
+	return rng->buf[rng->pos++];
+}
+
+// Uniform integer in [low, high). Scaling by a multiply and shift avoids
+// the division that `%` would cost.
+static inline uint gp_rand_range(GpRand * rng, uint low, uint high)
+{
+	return (uint)(((uint64_t)gp_rand_next(rng) * (high - low)) >> 32) + low;
+}
+
+// Switch a counter-based engine to the stream for (`step`, `slot`,
+// `purpose`). Does nothing in SFMT mode.
+static inline void gp_rand_stream(GpRand * rng, uint step, uint slot, uint purpose)
+{
+	if (rng->mode == GP_RAND_COUNTER) {
+		rng->ctr[0] = step;
+		rng->ctr[1] = slot;
+		rng->ctr[2] = purpose;
+		rng->ctr[3] = 0;
+		rng->pos = rng->end;
+	}
+}
 
 static inline uint umin(uint a, uint b)
 {
@@ -40,12 +108,12 @@ static inline uint umin(uint a, uint b)
 
 static inline uint urand(uint low, uint high)
 {
-	return sfmt_genrand_uint32(&_sfmt) % (high - low) + low;
+	return gp_rand_range(_gp_rng, low, high);
 }
 
 static inline double rand_double(void)
 {
-	return sfmt_genrand_real1(&_sfmt);
+	return sfmt_to_real1(gp_rand_next(_gp_rng));
 }
 
 static inline float rand_float(void)
@@ -13,18 +13,23 @@
 typedef enum {
 	GP_ARG_REGISTER = 0,
 	GP_ARG_CONSTANT,
+	GP_ARG_INPUT,
 	GP_ARG_COUNT
 } GpArgType;
 
 struct GpState_ {
 	gp_num_t registers[GP_MAX_REGISTERS];
+	const gp_num_t * inputs;
 	uint ip;
 };
 
+// `GP_ARG_INPUT` arguments read straight from the program's input vector,
+// so inputs don't have to be copied into (or fit in) the register file.
 struct GpArg_ {
 	GpArgType type;
 	union {
 		uint reg;
+		uint input;
 		gp_num_t num;
 	} data;
 };
@@ -44,10 +49,37 @@ struct GpStatement_ {
 struct GpProgram_ {
 	gp_fitness_t fitness;
 	int evaluated;
+	int approximate;
+	uint id;
 	uint num_stmts;
 	struct GpStatement_ * stmts;
+	int _busy;
 };
 
+// Dataset Structures
+
+// A set of fitness cases. Each row holds `num_inputs` inputs followed by
+// the target output. Datasets are either held entirely in memory, or
+// streamed from a file in chunks of `chunk_cases` rows (see _dataset.c_).
+// A window dataset keeps up to `capacity` rows in a ring, so cases can be
+// appended and retired while a world is evolving against it.
+struct GpDataset_ {
+	uint num_cases;
+	uint num_inputs;
+	uint capacity;
+	uint chunk_cases;
+	uint num_chunks;
+	gp_num_t * rows;
+
+	// private
+	struct GpStream_ * _stream;
+	uint _cursor;
+	uint _first;
+	int _window;
+};
+
+typedef struct GpDataset_ GpDataset;
+
 // World Structures
 
 struct GpWorld_;
@@ -55,11 +87,50 @@ typedef struct GpWorld_ GpWorld;
 typedef struct GpStatement_ GpStatement;
 typedef struct GpProgram_ GpProgram;
 
+// Which fitness cases the built-in evaluator scores programs on
+typedef enum {
+	GP_SAMPLE_ALL = 0,  // every case, every time
+	GP_SAMPLE_MINIBATCH,  // fixed random mini-batches, rotated in turn
+	GP_SAMPLE_DSS,  // dynamic subset selection, by case difficulty and age
+	GP_SAMPLE_PREDICTORS  // co-evolved fitness predictors
+} GpSampleMode;
+
+// Which evolutionary algorithm a world runs
+typedef enum {
+	GP_STEADY_STATE = 0,  // one tournament (or batch of them) at a time
+	GP_GENERATIONAL,  // a whole new population each generation
+	GP_PIPELINED,  // steady state, breeding while other threads score
+	GP_CELLULAR,  // local tournaments on a grid
+	GP_ASYNC  // steady state, offspring joining as their scores come back
+} GpAlgorithm;
+
+// Which cells around a cell make up its neighborhood on a cellular grid
+typedef enum {
+	GP_NEIGHBORHOOD_VON_NEUMANN = 0,  // within `neighborhood_radius` steps along the axes
+	GP_NEIGHBORHOOD_MOORE  // within a square `2 * neighborhood_radius + 1` cells wide
+} GpNeighborhood;
+
+// Whether and how a world is spread over the machine's NUMA nodes
+typedef enum {
+	GP_NUMA_OFF = 0,
+	GP_NUMA_FIRST_TOUCH,  // a thread on each node writes its programs first
+	GP_NUMA_BIND  // each node's programs are bound to it with `mbind`
+} GpNumaMode;
+
+// How parents are chosen
+typedef enum {
+	GP_SELECT_TOURNAMENT = 0,
+	GP_SELECT_LEXICASE,
+	GP_SELECT_EPSILON_LEXICASE
+} GpSelection;
+
 typedef struct GpWorldConf_ {
 	GpOperation * ops;
 	uint num_ops;
 	gp_fitness_t (*evaluator)(GpWorld *, GpProgram *);
+	void (*batch_evaluator)(GpWorld *, GpProgram **, uint, gp_fitness_t *);
 	gp_num_t (*constant_func)(void);
+	GpDataset * dataset;
 	uint population_size;
 	uint num_inputs;
 	uint num_registers;
@@ -70,6 +141,49 @@ typedef struct GpWorldConf_ {
 	float homologous_rate;
 	int minimize_fitness;
 	int auto_optimize;
+	int input_bank;
+	uint eval_batch_size;
+	GpSampleMode sample_mode;
+	uint sample_size;
+	uint sample_interval;
+	uint num_predictors;
+	uint num_trainers;
+	GpSelection selection;
+	uint lexicase_cases;
+	uint screen_cases;
+	float screen_margin;
+
+	// Threads, or 0 for one per online CPU. Generational and cellular
+	// worlds, worlds with `tournament_batch` other than 1, and worlds whose
+	// dataset is large enough to reach `split_threshold` keep a pool of them
+	// even when evolved through the serial functions. `parallel_init` starts
+	// one while the world is set up. With any of these, `evaluator` must be
+	// safe to call from several threads at once; set 1 for one that isn't.
+	uint num_threads;
+
+	uint seed;
+	GpRandMode rand_mode;
+	uint tournament_batch;
+	GpAlgorithm algorithm;
+	uint num_elites;
+	uint pipeline_depth;
+	GpNeighborhood neighborhood;
+	uint neighborhood_radius;
+	uint grid_width;
+	GpNumaMode numa;
+	float numa_exchange;
+	uint split_threshold;
+	uint max_in_flight;
+	uint num_processes;
+	float eval_timeout;
+	const char * farm_workers;
+	uint farm_window;
+	int lazy_evaluation;
+	uint surrogate_neighbors;
+	float surrogate_explore;
+	uint surrogate_memory;
+	int parallel_init;
+	int background_init;
 } GpWorldConf;
 
 struct GpWorld_ {
@@ -83,14 +197,185 @@ struct GpWorld_ {
 		gp_fitness_t best_fitness;
 		uint total_steps;
 		uint total_generations;
+		uint total_screened;
+		uint pipeline_stalls;
+		uint pipeline_starved;
+		float pipeline_depth;
+		uint numa_local;
+		uint numa_remote;
+		uint eval_timeouts;
+		uint eval_crashes;
+		uint farm_reassigned;
+		uint farm_local;
+		uint lazy_avoided;
+		float surrogate_accuracy;
 		float avg_program_length;
 	} stats;
 
 	// private
+	GpRand _rand;
 	GpStatement * _stmt_buf;
 	uint _last_optimize;
+	GpProgram ** _pending;
+	uint _num_pending;
+	float * _case_errors;
+	gp_fitness_t * _error_totals;
+
+	// Fitness case sampling state; `cases` is NULL when sampling is off
+	struct {
+		uint * cases;
+		uint size;
+		uint * order;
+		uint next;
+		float * difficulty;
+		uint * age;
+	} _sample;
+
+	// Co-evolved fitness predictors and the trainer programs they are
+	// judged against (see _predictor.c_)
+	struct {
+		uint * cases;
+		float * fitness;
+		uint best;
+		GpProgram * trainers;
+		GpStatement * trainer_stmts;
+		gp_fitness_t * trainer_fitness;
+		uint next_trainer;
+	} _predictors;
+
+	// Lexicase selection scratch space, and the slot each program id is in
+	struct {
+		uint * cases;
+		uint num_cases;
+		uint * candidates;
+		uint * survivors;
+		float * values;
+		float * epsilon;
+		uint epsilon_step;
+	} _lexicase;
+	uint * _id_slots;
+	gp_num_t * _screen_rows;
+
+	// Batched steady-state scratch space, and which batch each program was
+	// last drawn into
+	struct {
+		uint size;
+		GpProgram ** progs;
+		GpProgram ** children;
+		gp_fitness_t * thresholds;
+		uint * marks;
+		uint stamp;
+	} _batch;
+
+	// The population being bred by the generational algorithm, the
+	// tournaments drawn for it ahead of breeding when scoring lazily, and
+	// the worker threads it (and batch scoring) runs on
+	struct {
+		GpProgram * programs;
+		GpStatement * stmt_buf;
+		GpProgram ** children;
+		uint * ids;
+		GpProgram ** drawn;
+	} _next;
+	struct GpPool_ * _pool;
+
+	// The grid of a cellular world: its size, the offsets of a
+	// neighborhood's cells, and the stripes it is swept in
+	struct {
+		uint width;
+		uint height;
+		int * offsets;
+		uint num_offsets;
+		uint num_stripes;
+	} _cells;
+
+	// Nodes the population's ids are split between
+	uint _numa_nodes;
+
+	// Evaluator worker processes (see _procs.c_)
+	struct GpProcs_ * _procs;
+
+	// Connections to remote evaluator nodes (see _farm.c_)
+	struct GpFarm_ * _farm;
+
+	// Surrogate fitness model (see _surrogate.c_)
+	struct GpSurrogate_ * _surrogate;
+
+	// Scoring of the initial population in the background (see
+	// _background.c_)
+	struct GpBackground_ * _background;
 };
 
+// Archipelago Structures
+
+// Where each island takes its migrants from
+typedef enum {
+	GP_TOPOLOGY_RING = 0,  // the previous island
+	GP_TOPOLOGY_TORUS,  // each neighbour on a wrapped grid, in turn
+	GP_TOPOLOGY_RANDOM  // a random other island each time
+} GpTopology;
+
+typedef struct GpArchipelagoConf_ {
+	uint num_islands;
+	uint migration_interval;
+	uint num_migrants;
+	GpTopology topology;
+	uint torus_width;
+} GpArchipelagoConf;
+
+// A set of worlds evolving on their own threads, exchanging their best
+// programs now and then (see _archipelago.c_)
+struct GpArchipelago_ {
+	GpWorld ** islands;
+	GpArchipelagoConf conf;
+
+	struct {
+		gp_fitness_t avg_fitness;
+		gp_fitness_t best_fitness;
+		uint best_island;
+		ulong total_steps;
+		uint total_migrations;
+	} stats;
+
+	// private
+	struct GpIsland_ * _islands;
+};
+
+typedef struct GpArchipelago_ GpArchipelago;
+
+// Islands in separate processes, linked through shared memory (see
+// _link.c_). Every island opens the link with the same config, apart from
+// its own `island` index.
+typedef struct GpLinkConf_ {
+	const char * name;
+	uint num_islands;
+	uint island;
+	uint migration_interval;
+	uint num_migrants;
+	GpTopology topology;
+	uint torus_width;
+	uint ring_bytes;
+} GpLinkConf;
+
+struct GpLink_ {
+	GpLinkConf conf;
+
+	struct {
+		uint sent;
+		uint received;
+		uint dropped;
+		uint rejected;
+	} stats;
+
+	// private
+	void * _shm;
+	size_t _size;
+	uint _turn;
+	uint _next_migration;
+};
+
+typedef struct GpLink_ GpLink;
+
 //
 // ### Function prototypes ###
 //
@@ -116,7 +401,55 @@ uint        gp_world_evolve_secs   (GpWorld *, float);
 void        gp_world_evolve_gens   (GpWorld *, uint);
 void        gp_world_optimize      (GpWorld *);
 
+// Multithreaded evolution
+void        gp_world_evolve_times_parallel (GpWorld *, uint);
+uint        gp_world_evolve_secs_parallel  (GpWorld *, float);
+void        gp_world_evolve_gens_parallel  (GpWorld *, uint);
+
+// NUMA functions
+uint        gp_numa_num_nodes (void);
+int         gp_numa_node_of   (const void *);
+
+// Archipelago functions
+GpArchipelago *   gp_archipelago_new          (void);
+void              gp_archipelago_delete       (GpArchipelago *);
+void              gp_archipelago_initialize   (GpArchipelago *, GpArchipelagoConf, GpWorldConf);
+GpArchipelagoConf gp_archipelago_conf_default (void);
+void              gp_archipelago_evolve_times (GpArchipelago *, uint);
+ulong             gp_archipelago_evolve_secs  (GpArchipelago *, float);
+
+// Linked process functions
+GpLinkConf gp_link_conf_default (void);
+GpLink *   gp_link_open         (GpLinkConf);
+void       gp_link_close        (GpLink *);
+void       gp_link_unlink       (const char *);
+uint       gp_link_migrate      (GpLink *, GpWorld *, float);
+void       gp_link_evolve_times (GpLink *, GpWorld *, uint);
+
+// Evaluation farm functions
+void        gp_farm_serve     (GpWorld *, const char *);
+
+// Dataset functions
+GpDataset * gp_dataset_new        (uint, uint);
+GpDataset * gp_dataset_new_window (uint, uint);
+GpDataset * gp_dataset_open       (const char *, uint, uint);
+void        gp_dataset_delete     (GpDataset *);
+gp_num_t *  gp_dataset_row        (GpDataset *, uint);
+uint        gp_dataset_slot       (GpDataset *, uint);
+void        gp_dataset_append     (GpDataset *, const gp_num_t *, uint);
+void        gp_dataset_retire     (GpDataset *, uint);
+uint        gp_dataset_next_chunk (GpDataset *, gp_num_t **);
+
+// Evaluation functions
+gp_fitness_t gp_dataset_evaluate  (GpWorld *, GpProgram *);
+void        gp_world_evaluate     (GpWorld *, GpProgram **, uint);
+void        gp_world_flush_pending(GpWorld *);
+void        gp_world_append_cases (GpWorld *, const gp_num_t *, uint);
+void        gp_world_retire_cases (GpWorld *, uint);
+void        gp_world_resample     (GpWorld *);
+
 // Evolutionary operators
+GpProgram * gp_select_lexicase  (GpWorld *);
 void        gp_mutate           (GpWorld *, GpProgram *);
 void        gp_cross_homologous (GpProgram *, GpProgram *, GpProgram *, GpProgram *);
 void        gp_cross_twopoint   (GpWorld *, GpProgram *, GpProgram *, GpProgram *);
@@ -125,6 +458,6 @@ void        gp_cross_twopoint   (GpWorld *, GpProgram *, GpProgram *, GpProgram
 void        gp_world_optimize_test (void);
 void        gp_test_configurations_iters (GpWorldConf *, uint, uint, uint);
 void        gp_test_configurations_secs (GpWorldConf *, uint, float, uint);
-void        gp_test_performance    (void);
+int         gp_test_performance    (GpWorldConf, uint);
 
 #endif
@@ -27,6 +27,8 @@ typedef struct {
 #define GP_Arg(x) 														\
 	(args[x].type == GP_ARG_REGISTER ?									\
 		state->registers[args[x].data.reg] :							\
+	 args[x].type == GP_ARG_INPUT ?										\
+		state->inputs[args[x].data.input] :								\
 		args[x].data.num)												\
 
 #define GP_MAX_ARGS 2
@@ -0,0 +1,350 @@
+//
+// _archipelago.c_ runs several worlds side by side as islands, each on its
+// own thread with its own random generator and statement buffer. Every
+// `migration_interval` steps an island sends copies of its best
+// `num_migrants` programs out, and takes in another island's migrants in
+// place of its worst programs. Which island it takes them from is set by
+// the topology.
+//
+// Islands never wait for each other. Each one publishes its emigrants in
+// an outbox guarded by a sequence lock: the owner makes the sequence odd
+// while it writes and even again when done, and a reader copies the
+// outbox and retries if the sequence changed meanwhile. Neither side ever
+// blocks, so migration costs an island only its own copying. Which
+// migrants an island receives depends on how far its neighbours have got,
+// so runs are not reproducible, even with a fixed seed.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "gp.h"
+#include "mem.h"
+#include "evolve.h"
+#include "os.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+// Steps an island runs between clock checks when evolving for a fixed time
+#define GP_ISLAND_SLICE 1000
+
+struct GpIsland_ {
+	GpArchipelago * archipelago;
+	GpWorld * world;
+	uint index;
+	uint next_migration;
+	uint turn;
+	pthread_t thread;
+
+	// The island's latest emigrants, and its copy of a neighbour's
+	uint seq;
+	GpProgram * outbox;
+	GpProgram * inbox;
+	GpStatement * stmt_buf;
+} __attribute__((aligned(64)));
+
+typedef struct GpIsland_ GpIsland;
+
+typedef struct {
+	GpIsland * island;
+	uint times;
+	double deadline;
+} _Run;
+
+static void _archipelago_err(const char * estr)
+{
+	printf("libgp archipelago ERROR: %s\n", estr);
+	abort();
+}
+
+GpArchipelago * gp_archipelago_new()
+{
+	GpArchipelago * archipelago = new(GpArchipelago);
+	archipelago->islands = NULL;
+	archipelago->_islands = NULL;
+	archipelago->conf.num_islands = 0;
+
+	archipelago->stats.avg_fitness = 0;
+	archipelago->stats.best_fitness = 0;
+	archipelago->stats.best_island = 0;
+	archipelago->stats.total_steps = 0;
+	archipelago->stats.total_migrations = 0;
+
+	return archipelago;
+}
+
+void gp_archipelago_delete(GpArchipelago * archipelago)
+{
+	for (uint i = 0; i < archipelago->conf.num_islands; i++) {
+		GpIsland * island = archipelago->_islands + i;
+		gp_world_delete(island->world);
+		delete(island->outbox);
+		delete(island->inbox);
+		delete(island->stmt_buf);
+	}
+	delete(archipelago->islands);
+	delete(archipelago->_islands);
+	delete(archipelago);
+}
+
+// Returns a default config: four islands in a ring
+GpArchipelagoConf gp_archipelago_conf_default()
+{
+	return (GpArchipelagoConf) {
+		.num_islands = 4,
+		.migration_interval = 10000,
+		.num_migrants = 4,
+		.topology = GP_TOPOLOGY_RING,
+		.torus_width = 0
+	};
+}
+
+//
+// `gp_archipelago_initialize` creates and initializes `conf.num_islands`
+// worlds from `world_conf`. Islands are the unit of parallelism, so each
+// world runs on a single thread whatever `world_conf.num_threads` says.
+// They all get different seeds, derived from `world_conf.seed` if it is
+// set.
+//
+void gp_archipelago_initialize(GpArchipelago * archipelago, GpArchipelagoConf conf, GpWorldConf world_conf)
+{
+	uint i;
+
+	if (conf.num_islands == 0)
+		_archipelago_err("num_islands must be at least 1");
+
+	if (conf.migration_interval == 0)
+		_archipelago_err("migration_interval must be at least 1");
+
+	if (conf.num_migrants * 2 > world_conf.population_size)
+		_archipelago_err("num_migrants must be at most half of population_size");
+
+	if (conf.topology == GP_TOPOLOGY_TORUS && conf.torus_width > 0
+		&& conf.num_islands % conf.torus_width != 0)
+		_archipelago_err("torus_width must divide num_islands");
+
+	// Every island reads the dataset at once
+	if (world_conf.dataset != NULL && world_conf.dataset->_stream != NULL)
+		_archipelago_err("islands cannot share a streamed dataset");
+
+	if (conf.topology == GP_TOPOLOGY_TORUS)
+		conf.torus_width = gp_topology_width(conf.num_islands, conf.torus_width);
+
+	archipelago->conf = conf;
+	archipelago->islands = new_array(GpWorld *, conf.num_islands);
+	archipelago->_islands = new_array(GpIsland, conf.num_islands);
+
+	GpRand * const caller_rng = _gp_rng;
+	const uint32_t seed = world_conf.seed != 0 ? world_conf.seed : gp_rand_next(_gp_rng);
+	const uint max_length = world_conf.max_program_length;
+	world_conf.num_threads = 1;
+
+	for (i = 0; i < conf.num_islands; i++)
+	{
+		GpIsland * island = archipelago->_islands + i;
+		island->archipelago = archipelago;
+		island->index = i;
+		island->next_migration = conf.migration_interval;
+		island->turn = 0;
+		island->seq = 0;
+
+		// Spread the seeds out, and never hit 0, which means "pick one"
+		world_conf.seed = seed + i * 0x9E3779B9u;
+		if (world_conf.seed == 0)
+			world_conf.seed = 1;
+
+		island->world = gp_world_new();
+		gp_world_initialize(island->world, world_conf);
+		archipelago->islands[i] = island->world;
+
+		island->outbox = new_array(GpProgram, conf.num_migrants);
+		island->inbox = new_array(GpProgram, conf.num_migrants);
+		island->stmt_buf = new_array(GpStatement, conf.num_migrants * 2 * max_length);
+		for (uint j = 0; j < conf.num_migrants; j++) {
+			island->outbox[j].stmts = island->stmt_buf + j * max_length;
+			island->inbox[j].stmts = island->stmt_buf + (conf.num_migrants + j) * max_length;
+		}
+	}
+
+	// Initializing an island switched the caller to its generator
+	_gp_rng = caller_rng;
+}
+
+//
+// The island that island `i` of `n` exchanges its `turn`th migrants with:
+// the previous one in a ring, each neighbour on a `width`-wide torus in
+// turn (left, up, right, down), or a random other island.
+//
+uint gp_topology_neighbour(GpTopology topology, uint n, uint width, uint i, uint turn)
+{
+	switch (topology)
+	{
+	case GP_TOPOLOGY_TORUS:
+	{
+		const uint x = i % width, row = i - x;
+		switch (turn % 4) {
+		case 0: return row + (x + width - 1) % width;
+		case 1: return (i + n - width) % n;
+		case 2: return row + (x + 1) % width;
+		default: return (i + width) % n;
+		}
+	}
+
+	case GP_TOPOLOGY_RANDOM:
+	{
+		const uint other = urand(0, n - 1);
+		return other < i ? other : other + 1;
+	}
+
+	default:
+		return (i + n - 1) % n;
+	}
+}
+
+// The width of a torus of `n` islands (or cells): `width` if it is set,
+// otherwise that of the most nearly square grid
+uint gp_topology_width(uint n, uint width)
+{
+	if (width == 0)
+		for (width = 1; width * width < n; width++);
+	while (n % width != 0)
+		width--;
+	return width;
+}
+
+//
+// Publish the island's best programs and take in a neighbour's. Islands
+// evolve through `gp_world_evolve_times`, which leaves the population
+// sorted best first, so the best and worst are at either end. Migrants are
+// rescored on arrival, as islands may sample different cases.
+//
+static void _migrate(GpIsland * island)
+{
+	GpWorld * world = island->world;
+	const uint k = island->archipelago->conf.num_migrants;
+	const uint popsize = world->conf.population_size;
+	uint i;
+
+	__atomic_store_n(&island->seq, island->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (i = 0; i < k; i++)
+		gp_program_copy(world->programs + i, island->outbox + i);
+	__atomic_store_n(&island->seq, island->seq + 1, __ATOMIC_RELEASE);
+
+	if (island->archipelago->conf.num_islands < 2)
+		return;
+
+	const GpArchipelagoConf * conf = &island->archipelago->conf;
+	GpIsland * source = island->archipelago->_islands + gp_topology_neighbour(conf->topology,
+		conf->num_islands, conf->torus_width, island->index, island->turn++);
+	uint seq;
+	for (;;) {
+		seq = __atomic_load_n(&source->seq, __ATOMIC_ACQUIRE);
+		if (seq == 0)
+			return;
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+
+		for (i = 0; i < k; i++)
+			gp_program_copy(source->outbox + i, island->inbox + i);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&source->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+
+	GpProgram ** immigrants = new_array(GpProgram *, k);
+	for (i = 0; i < k; i++) {
+		immigrants[i] = world->programs + popsize - k + i;
+		gp_program_copy(island->inbox + i, immigrants[i]);
+		immigrants[i]->approximate = 0;
+	}
+	gp_world_evaluate(world, immigrants, k);
+	delete(immigrants);
+
+	__atomic_fetch_add(&island->archipelago->stats.total_migrations, 1, __ATOMIC_RELAXED);
+}
+
+static void * _island_main(void * arg)
+{
+	_Run * run = arg;
+	GpIsland * island = run->island;
+	GpWorld * world = island->world;
+	const uint interval = island->archipelago->conf.migration_interval;
+	const uint target = world->stats.total_steps + run->times;
+
+	gp_world_use_rand(world);
+	for (;;)
+	{
+		const uint steps = world->stats.total_steps;
+		if (run->deadline > 0 ? gp_now() >= run->deadline : steps >= target)
+			break;
+
+		if (steps >= island->next_migration) {
+			_migrate(island);
+			while (island->next_migration <= steps)
+				island->next_migration += interval;
+		}
+
+		uint chunk = island->next_migration - steps;
+		if (run->deadline > 0)
+			chunk = umin(chunk, GP_ISLAND_SLICE);
+		else
+			chunk = umin(chunk, target - steps);
+		gp_world_evolve_times(world, chunk);
+	}
+
+	return NULL;
+}
+
+static void _run(GpArchipelago * archipelago, uint times, float nsecs)
+{
+	const uint n = archipelago->conf.num_islands;
+	_Run * runs = new_array(_Run, n);
+	const double deadline = nsecs > 0 ? gp_now() + nsecs : 0;
+	uint i;
+
+	for (i = 0; i < n; i++) {
+		runs[i].island = archipelago->_islands + i;
+		runs[i].times = times;
+		runs[i].deadline = deadline;
+		pthread_create(&runs[i].island->thread, NULL, &_island_main, runs + i);
+	}
+	for (i = 0; i < n; i++)
+		pthread_join(archipelago->_islands[i].thread, NULL);
+	delete(runs);
+
+	// Gather the islands' stats
+	gp_fitness_t total_fitness = 0;
+	archipelago->stats.total_steps = 0;
+	archipelago->stats.best_island = 0;
+	for (i = 0; i < n; i++)
+	{
+		GpWorld * world = archipelago->islands[i];
+		const gp_fitness_t best = archipelago->islands[archipelago->stats.best_island]->stats.best_fitness;
+
+		total_fitness += world->stats.avg_fitness;
+		archipelago->stats.total_steps += world->stats.total_steps;
+		if (world->conf.minimize_fitness ? world->stats.best_fitness < best : world->stats.best_fitness > best)
+			archipelago->stats.best_island = i;
+	}
+	archipelago->stats.avg_fitness = total_fitness / n;
+	archipelago->stats.best_fitness = archipelago->islands[archipelago->stats.best_island]->stats.best_fitness;
+}
+
+// Evolve every island `times` steps.
+void gp_archipelago_evolve_times(GpArchipelago * archipelago, uint times)
+{
+	_run(archipelago, times, 0);
+}
+
+// Evolve every island until `nsecs` seconds have passed. Returns the
+// number of steps taken by all of the islands together.
+ulong gp_archipelago_evolve_secs(GpArchipelago * archipelago, float nsecs)
+{
+	const ulong steps_before = archipelago->stats.total_steps;
+	_run(archipelago, 0, nsecs);
+	return archipelago->stats.total_steps - steps_before;
+}
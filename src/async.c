@@ -0,0 +1,235 @@
+//
+// _async.c_ runs the steady-state algorithm asynchronously, used when
+// `algorithm` is `GP_ASYNC`. It suits evaluators that take milliseconds
+// or more per program, such as simulations. The calling thread breeds
+// offspring and queues them for `num_threads` evaluator threads, and
+// selection carries on meanwhile with the programs already scored. Each
+// offspring joins the population as soon as its score comes back, in
+// place of the worse of two programs drawn at that moment.
+//
+// Offspring only join the population once they are scored, so no
+// tournament ever draws a program whose fitness isn't known. At most
+// `max_in_flight` offspring are queued or being scored at once. When that
+// many are out the breeder sleeps until one comes back, and evaluators
+// without work sleep until there is some, so no core spins while a slow
+// evaluation runs. What a returning offspring replaces depends on timing,
+// so runs are not reproducible, even with a fixed seed.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "gp.h"
+#include "mem.h"
+#include "evolve.h"
+#include "pool.h"
+#include "os.h"
+
+#include <pthread.h>
+
+typedef struct {
+	GpWorld * world;
+	GpProgram * children;
+	uint capacity;
+
+	// Offspring waiting for an evaluator, in a ring, and those scored
+	uint * queue;
+	uint queue_head;
+	uint queue_count;
+	uint * scored;
+	uint num_scored;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	int stop;
+} _Async;
+
+typedef struct {
+	_Async * async;
+	uint32_t seed;
+	pthread_t thread;
+} _Evaluator;
+
+static void * _evaluator_main(void * arg)
+{
+	_Evaluator * evaluator = arg;
+	_Async * async = evaluator->async;
+	GpWorld * world = async->world;
+
+	GpRand rng;
+	gp_rand_seed(&rng, evaluator->seed, GP_RAND_SFMT);
+	_gp_rng = &rng;
+
+	pthread_mutex_lock(&async->lock);
+	for (;;)
+	{
+		while (!async->stop && async->queue_count == 0)
+			pthread_cond_wait(&async->work, &async->lock);
+		if (async->stop)
+			break;
+
+		const uint c = async->queue[async->queue_head];
+		async->queue_head = (async->queue_head + 1) % async->capacity;
+		async->queue_count--;
+		pthread_mutex_unlock(&async->lock);
+
+		GpProgram * child = async->children + c;
+		child->fitness = world->conf.evaluator(world, child);
+		child->evaluated = 1;
+
+		pthread_mutex_lock(&async->lock);
+		async->scored[async->num_scored++] = c;
+		pthread_cond_signal(&async->done);
+	}
+	pthread_mutex_unlock(&async->lock);
+
+	return NULL;
+}
+
+// Put a scored offspring in place of the worse of two other programs
+static void _insert(GpWorld * world, GpProgram * child)
+{
+	const uint popsize = world->conf.population_size;
+	const uint a = urand(0, popsize);
+	const uint b = (a + urand(1, popsize)) % popsize;
+	GpProgram * x = world->programs + a;
+	GpProgram * y = world->programs + b;
+
+	const int x_worse = world->conf.minimize_fitness ? x->fitness > y->fitness : x->fitness < y->fitness;
+	gp_program_copy(child, x_worse ? x : y);
+}
+
+// Breed two offspring from the winners of a tournament
+static void _breed(GpWorld * world, GpProgram * child0, GpProgram * child1)
+{
+	const uint popsize = world->conf.population_size;
+	GpProgram * progs[] = {
+		world->programs + urand(0, popsize),
+		world->programs + urand(0, popsize),
+		world->programs + urand(0, popsize),
+		world->programs + urand(0, popsize)
+	};
+
+	gp_tournament_sort(world, progs);
+	progs[2] = child0;
+	progs[3] = child1;
+	gp_world_vary(world, progs);
+}
+
+//
+// `gp_world_evolve_async` breeds `times` tournaments' offspring or, if
+// `nsecs` is positive, keeps breeding for that many seconds, and returns
+// once every offspring bred has been scored and inserted. A step is
+// counted for every two offspring inserted. The evaluator must be safe to
+// call from several threads at once.
+//
+void gp_world_evolve_async(GpWorld * world, uint times, float nsecs)
+{
+	const uint num_evaluators = gp_pool_size(world->conf.num_threads);
+	const uint max_length = world->conf.max_program_length;
+	uint i;
+
+	_Async async;
+	async.world = world;
+	async.capacity = world->conf.max_in_flight > 0 ? world->conf.max_in_flight : num_evaluators * 2;
+	async.capacity = gp_max(async.capacity, 2);
+	async.children = new_array(GpProgram, async.capacity);
+	async.queue = new_array(uint, async.capacity);
+	async.queue_head = async.queue_count = 0;
+	async.scored = new_array(uint, async.capacity);
+	async.num_scored = 0;
+	async.stop = 0;
+	pthread_mutex_init(&async.lock, NULL);
+	pthread_cond_init(&async.work, NULL);
+	pthread_cond_init(&async.done, NULL);
+
+	GpStatement * stmt_buf = new_array(GpStatement, async.capacity * max_length);
+	uint * free_children = new_array(uint, async.capacity);
+	uint * arrived = new_array(uint, async.capacity);
+	uint num_free = async.capacity;
+	for (i = 0; i < async.capacity; i++) {
+		GpProgram * child = async.children + i;
+		child->stmts = stmt_buf + i * max_length;
+		child->id = (uint)-1;
+		child->evaluated = 0;
+		child->approximate = 0;
+		child->_busy = 0;
+		free_children[i] = i;
+	}
+
+	_Evaluator * evaluators = new_array(_Evaluator, num_evaluators);
+	for (i = 0; i < num_evaluators; i++) {
+		evaluators[i].async = &async;
+		evaluators[i].seed = gp_rand_next(&world->_rand);
+		pthread_create(&evaluators[i].thread, NULL, &_evaluator_main, evaluators + i);
+	}
+
+	const double deadline = gp_now() + nsecs;
+	uint bred = 0, inserted = 0;
+
+	gp_world_use_rand(world);
+
+	for (;;)
+	{
+		const int more = nsecs > 0 ? gp_now() < deadline : bred < times;
+		uint num_arrived;
+
+		// Wait for scored offspring only when nothing can be bred
+		pthread_mutex_lock(&async.lock);
+		while (async.num_scored == 0 && num_free < async.capacity && !(more && num_free >= 2))
+			pthread_cond_wait(&async.done, &async.lock);
+		num_arrived = async.num_scored;
+		for (i = 0; i < num_arrived; i++)
+			arrived[i] = async.scored[i];
+		async.num_scored = 0;
+		pthread_mutex_unlock(&async.lock);
+
+		if (!more && num_arrived == 0 && num_free == async.capacity)
+			break;
+
+		const uint step = world->stats.total_steps;
+		for (i = 0; i < num_arrived; i++) {
+			_insert(world, async.children + arrived[i]);
+			free_children[num_free++] = arrived[i];
+			if (++inserted % 2 == 0)
+				world->stats.total_steps++;
+		}
+
+		// Intron removal moves no programs, and offspring in flight aren't
+		// part of the population
+		if (world->conf.auto_optimize && world->stats.total_steps / 300000 != step / 300000)
+			gp_world_optimize(world);
+
+		if (more && num_free >= 2)
+		{
+			const uint c0 = free_children[--num_free];
+			const uint c1 = free_children[--num_free];
+			_breed(world, async.children + c0, async.children + c1);
+			bred++;
+
+			pthread_mutex_lock(&async.lock);
+			async.queue[(async.queue_head + async.queue_count++) % async.capacity] = c0;
+			async.queue[(async.queue_head + async.queue_count++) % async.capacity] = c1;
+			pthread_cond_broadcast(&async.work);
+			pthread_mutex_unlock(&async.lock);
+		}
+	}
+
+	pthread_mutex_lock(&async.lock);
+	async.stop = 1;
+	pthread_cond_broadcast(&async.work);
+	pthread_mutex_unlock(&async.lock);
+	for (i = 0; i < num_evaluators; i++)
+		pthread_join(evaluators[i].thread, NULL);
+
+	pthread_mutex_destroy(&async.lock);
+	pthread_cond_destroy(&async.work);
+	pthread_cond_destroy(&async.done);
+	delete(evaluators);
+	delete(arrived);
+	delete(free_children);
+	delete(async.children);
+	delete(async.queue);
+	delete(async.scored);
+	delete(stmt_buf);
+}
@@ -0,0 +1,119 @@
+//
+// _background.c_ scores the initial population on a thread of its own,
+// used when `background_init` is set, so that evolution can start before
+// every program has a score. The thread scores the programs in order, a
+// chunk at a time, through `gp_world_evaluate`, so a batch evaluator or
+// an idle thread pool still takes whole chunks. Steady-state tournaments
+// only draw from the programs scored so far, which the thread is done
+// with, so their offspring never overwrite a program being scored.
+//
+// Anything that needs the whole population, such as taking stats or
+// removing introns, first waits for the thread to finish. Which programs
+// the first tournaments see depends on how far the thread has got, so
+// runs that use it aren't reproducible.
+//
+
+#include "gp.h"
+#include "mem.h"
+#include "evolve.h"
+#include "pool.h"
+
+#include <pthread.h>
+
+// Programs scored between updates of the count
+#define GP_BACKGROUND_CHUNK 256
+
+typedef struct GpBackground_ GpBackground;
+
+struct GpBackground_ {
+	GpWorld * world;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t progress;
+	uint scored;
+	int owns_pool;
+
+	// For evaluators that draw random numbers
+	GpRand rng;
+};
+
+static void * _background_main(void * arg)
+{
+	GpBackground * background = arg;
+	GpWorld * world = background->world;
+	const uint popsize = world->conf.population_size;
+	GpProgram * chunk[GP_BACKGROUND_CHUNK];
+
+	_gp_rng = &background->rng;
+
+	for (uint first = 0; first < popsize; first += GP_BACKGROUND_CHUNK)
+	{
+		const uint count = umin(GP_BACKGROUND_CHUNK, popsize - first);
+		for (uint i = 0; i < count; i++)
+			chunk[i] = world->programs + first + i;
+		gp_world_evaluate(world, chunk, count);
+
+		pthread_mutex_lock(&background->lock);
+		__atomic_store_n(&background->scored, first + count, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&background->progress);
+		pthread_mutex_unlock(&background->lock);
+	}
+	return NULL;
+}
+
+//
+// `gp_background_start` starts scoring the initial population. If
+// `owns_pool` is set, the world's thread pool was started only for
+// initialization, and is stopped once the population is scored.
+//
+void gp_background_start(GpWorld * world, int owns_pool)
+{
+	GpBackground * background = new(GpBackground);
+	world->_background = background;
+	background->world = world;
+	background->scored = 0;
+	gp_rand_seed(&background->rng, gp_rand_next(_gp_rng), world->_rand.mode);
+	background->owns_pool = owns_pool;
+	pthread_mutex_init(&background->lock, NULL);
+	pthread_cond_init(&background->progress, NULL);
+	pthread_create(&background->thread, NULL, &_background_main, background);
+}
+
+// How many programs, from the first, are scored, once at least `min` are.
+// Once all of them are, the thread is finished with.
+uint gp_background_scored(GpWorld * world, uint min)
+{
+	GpBackground * background = world->_background;
+	uint scored = __atomic_load_n(&background->scored, __ATOMIC_ACQUIRE);
+
+	if (scored < min) {
+		pthread_mutex_lock(&background->lock);
+		while ((scored = __atomic_load_n(&background->scored, __ATOMIC_ACQUIRE)) < min)
+			pthread_cond_wait(&background->progress, &background->lock);
+		pthread_mutex_unlock(&background->lock);
+	}
+
+	if (scored == world->conf.population_size)
+		gp_background_finish(world);
+	return scored;
+}
+
+// Wait for the whole initial population to be scored
+void gp_background_finish(GpWorld * world)
+{
+	GpBackground * background = world->_background;
+	if (background == NULL)
+		return;
+
+	pthread_join(background->thread, NULL);
+	pthread_mutex_destroy(&background->lock);
+	pthread_cond_destroy(&background->progress);
+
+	if (background->owns_pool) {
+		gp_pool_delete(world->_pool);
+		world->_pool = NULL;
+	}
+
+	delete(background);
+	world->_background = NULL;
+}
@@ -0,0 +1,154 @@
+//
+// _cellular.c_ implements the cellular algorithm, used when `algorithm` is
+// `GP_CELLULAR`. The program with id `i` lives on cell `i` of a
+// `grid_width`-wide torus, counting row by row, and each tournament draws
+// its four programs from the neighborhood of one cell. Good programs thus
+// spread over the grid only gradually. Ids stay with their statement
+// blocks, so a neighborhood's statements lie in a few short runs of the
+// statement buffer rather than all over it.
+//
+// A sweep runs `population_size / 2` tournaments. The grid's rows are
+// split into an even number of stripes, each at least `2 * radius` rows
+// tall, so tournaments centred in stripes that aren't adjacent never touch
+// the same cell. The even stripes run in parallel on the world's thread
+// pool, then the odd ones, without any locking. Each stripe draws from its
+// own random stream, so in counter mode a sweep gives the same result on
+// any number of threads.
+//
+
+#include "gp.h"
+#include "mem.h"
+#include "evolve.h"
+#include "pool.h"
+
+typedef struct {
+	GpWorld * world;
+	uint step;
+	uint phase;
+	GpCounters * counters;
+} _Sweep;
+
+// First row of stripe `stripe`
+static inline uint _stripe_row(GpWorld * world, uint stripe)
+{
+	return stripe * world->_cells.height / world->_cells.num_stripes;
+}
+
+static inline GpProgram * _cell_program(GpWorld * world, uint x, uint y)
+{
+	return world->programs + world->_id_slots[y * world->_cells.width + x];
+}
+
+// Run the tournaments centred in the `index`th stripe of this phase
+static void _sweep_stripe(void * arg, uint index)
+{
+	_Sweep * sweep = arg;
+	GpWorld * world = sweep->world;
+	const uint stripe = index * 2 + sweep->phase;
+	const uint width = world->_cells.width;
+	const uint height = world->_cells.height;
+	const uint first_row = _stripe_row(world, stripe);
+	const uint num_rows = _stripe_row(world, stripe + 1) - first_row;
+	const int * offsets = world->_cells.offsets;
+	GpProgram * progs[4];
+
+	gp_rand_stream(_gp_rng, sweep->step, stripe, GP_STREAM_SELECT);
+
+	for (uint t = 0; t < num_rows * width / 2; t++)
+	{
+		const uint x = urand(0, width);
+		const uint y = first_row + urand(0, num_rows);
+
+		// Neighborhoods are small, so draw four different cells: a program
+		// must not be both a parent and a loser
+		for (uint j = 0; j < 4; j++) {
+			uint k;
+			do {
+				const int * offset = offsets + urand(0, world->_cells.num_offsets) * 2;
+				progs[j] = _cell_program(world, (x + width + offset[0]) % width, (y + height + offset[1]) % height);
+				for (k = 0; k < j && progs[k] != progs[j]; k++);
+			} while (k < j);
+		}
+
+		gp_world_tournament(world, progs, sweep->counters + stripe);
+	}
+}
+
+//
+// `gp_world_cells_init` lays the population out on its grid and lists
+// the offsets of a neighborhood's cells.
+//
+void gp_world_cells_init(GpWorld * world)
+{
+	const uint popsize = world->conf.population_size;
+	const int r = world->conf.neighborhood_radius;
+	uint i;
+
+	world->_cells.width = gp_topology_width(popsize, world->conf.grid_width);
+	world->_cells.height = popsize / world->_cells.width;
+	world->conf.grid_width = world->_cells.width;
+
+	world->_cells.offsets = new_array(int, (2 * r + 1) * (2 * r + 1) * 2);
+	world->_cells.num_offsets = 0;
+	for (int dy = -r; dy <= r; dy++) {
+		for (int dx = -r; dx <= r; dx++) {
+			if (world->conf.neighborhood == GP_NEIGHBORHOOD_VON_NEUMANN && abs(dx) + abs(dy) > r)
+				continue;
+			world->_cells.offsets[world->_cells.num_offsets * 2] = dx;
+			world->_cells.offsets[world->_cells.num_offsets * 2 + 1] = dy;
+			world->_cells.num_offsets++;
+		}
+	}
+
+	// As many stripes as keep them all `2 * r` rows tall, rounded down to
+	// an even number, or a single stripe if the grid is too short for two
+	uint stripes = world->_cells.height / (2 * r);
+	world->_cells.num_stripes = stripes >= 2 ? stripes & ~1u : 1;
+
+	// Cells are ids, which sorting the population leaves in place
+	if (world->_id_slots == NULL) {
+		world->_id_slots = new_array(uint, popsize);
+		for (i = 0; i < popsize; i++)
+			world->_id_slots[world->programs[i].id] = i;
+	}
+}
+
+// `gp_world_evolve_cellular` runs one sweep, which counts as
+// `population_size / 2` steps.
+void gp_world_evolve_cellular(GpWorld * world)
+{
+	const uint num_stripes = world->_cells.num_stripes;
+	const uint step = world->stats.total_steps;
+	GpCounters * counters = new_array(GpCounters, num_stripes);
+	uint i;
+
+	for (i = 0; i < num_stripes; i++)
+		counters[i].steps = counters[i].screened = 0;
+
+	_Sweep sweep = { world, step, 0, counters };
+
+	if (num_stripes == 1)
+		_sweep_stripe(&sweep, 0);
+	else for (sweep.phase = 0; sweep.phase < 2; sweep.phase++)
+	{
+		// Deferred scoring queues offspring in a shared list
+		if (world->_pool != NULL && world->_pending == NULL)
+			gp_pool_run(world->_pool, &_sweep_stripe, &sweep, num_stripes / 2);
+		else
+			for (i = 0; i < num_stripes / 2; i++)
+				_sweep_stripe(&sweep, i);
+	}
+
+	for (i = 0; i < num_stripes; i++) {
+		world->stats.total_steps += counters[i].steps;
+		world->stats.total_screened += counters[i].screened;
+	}
+	delete(counters);
+
+	if (world->conf.auto_optimize && world->stats.total_steps / 300000 != step / 300000)
+		gp_world_optimize(world);
+
+	if (world->_sample.cases != NULL
+		&& world->stats.total_steps / world->conf.sample_interval != step / world->conf.sample_interval)
+		gp_world_resample(world);
+}
@@ -0,0 +1,331 @@
+//
+// _dataset.c_ contains fitness case storage. Small datasets live in
+// memory; datasets too large to sit next to the population are streamed
+// from disk in fixed-size chunks, with a background thread reading the
+// next chunk while the current one is being evaluated. Window datasets
+// hold a sliding range of cases from a live feed.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "gp.h"
+#include "mem.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+enum {
+	GP_CHUNK_FREE = 0,
+	GP_CHUNK_LOADING,
+	GP_CHUNK_READY,
+	GP_CHUNK_IN_USE
+};
+
+// Double-buffered prefetch state for a streamed dataset. While the
+// evaluator holds one buffer, the prefetch thread fills the other one with
+// the chunk that will be requested next.
+struct GpStream_ {
+	int fd;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stop;
+
+	gp_num_t * bufs[2];
+	int state[2];
+	uint chunk[2];
+	uint count[2];
+	uint next_load;
+};
+
+static void _dataset_err(const char * estr)
+{
+	printf("libgp dataset ERROR: %s\n", estr);
+	abort();
+}
+
+static inline size_t _row_size(GpDataset * ds)
+{
+	return (ds->num_inputs + 1) * sizeof(gp_num_t);
+}
+
+// Number of rows in chunk `idx`; only the last chunk may be short.
+static inline uint _chunk_count(GpDataset * ds, uint idx)
+{
+	return umin(ds->chunk_cases, ds->num_cases - idx * ds->chunk_cases);
+}
+
+static void _read_rows(GpDataset * ds, gp_num_t * dst, uint first, uint count)
+{
+	char * buf = (char *)dst;
+	size_t left = count * _row_size(ds);
+	off_t offset = (off_t)first * _row_size(ds);
+
+	while (left > 0) {
+		ssize_t n = pread(ds->_stream->fd, buf, left, offset);
+		if (n <= 0)
+			_dataset_err("short read from dataset file");
+		buf += n;
+		offset += n;
+		left -= n;
+	}
+}
+
+static void * _prefetch_thread(void * arg)
+{
+	GpDataset * ds = arg;
+	struct GpStream_ * st = ds->_stream;
+
+	pthread_mutex_lock(&st->lock);
+	for (;;)
+	{
+		int b;
+		while (!st->stop && st->state[0] != GP_CHUNK_FREE && st->state[1] != GP_CHUNK_FREE)
+			pthread_cond_wait(&st->cond, &st->lock);
+		if (st->stop)
+			break;
+
+		b = st->state[0] == GP_CHUNK_FREE ? 0 : 1;
+		const uint idx = st->next_load;
+		st->next_load = (idx + 1) % ds->num_chunks;
+		st->state[b] = GP_CHUNK_LOADING;
+		pthread_mutex_unlock(&st->lock);
+
+		const uint count = _chunk_count(ds, idx);
+		const off_t start = (off_t)idx * ds->chunk_cases * _row_size(ds);
+		const off_t len = (off_t)count * _row_size(ds);
+
+		_read_rows(ds, st->bufs[b], idx * ds->chunk_cases, count);
+
+		// The chunk now lives in our own buffer, so drop it from the page
+		// cache rather than letting it push the population out to swap,
+		// and ask the kernel to start reading the chunk after this one.
+		posix_fadvise(st->fd, start, len, POSIX_FADV_DONTNEED);
+		posix_fadvise(st->fd, start + len, len, POSIX_FADV_WILLNEED);
+
+		pthread_mutex_lock(&st->lock);
+		st->chunk[b] = idx;
+		st->count[b] = count;
+		st->state[b] = GP_CHUNK_READY;
+		pthread_cond_broadcast(&st->cond);
+	}
+	pthread_mutex_unlock(&st->lock);
+
+	return NULL;
+}
+
+// `gp_dataset_new` allocates an in-memory dataset of `num_cases` rows.
+// Rows are filled in by the caller through `gp_dataset_row`.
+GpDataset * gp_dataset_new(uint num_inputs, uint num_cases)
+{
+	GpDataset * ds = new(GpDataset);
+	ds->num_inputs = num_inputs;
+	ds->num_cases = num_cases;
+	ds->capacity = num_cases;
+	ds->chunk_cases = num_cases;
+	ds->num_chunks = 1;
+	ds->rows = new_array(gp_num_t, (size_t)num_cases * (num_inputs + 1));
+	ds->_stream = NULL;
+	ds->_cursor = 0;
+	ds->_first = 0;
+	ds->_window = 0;
+	return ds;
+}
+
+// `gp_dataset_new_window` allocates an empty dataset that holds at most
+// `capacity` cases. New cases are added with `gp_dataset_append` (or
+// `gp_world_append_cases` once a world is using it), which retires the
+// oldest cases when the window is full.
+GpDataset * gp_dataset_new_window(uint num_inputs, uint capacity)
+{
+	GpDataset * ds = gp_dataset_new(num_inputs, capacity);
+	ds->num_cases = 0;
+	ds->_window = 1;
+	return ds;
+}
+
+// `gp_dataset_open` streams a dataset from the file at `path`, which holds
+// raw `gp_num_t` rows in the same layout as an in-memory dataset. At most
+// two chunks of `chunk_cases` rows are resident at any time. Returns NULL
+// if the file cannot be opened or holds no rows.
+GpDataset * gp_dataset_open(const char * path, uint num_inputs, uint chunk_cases)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	off_t size = lseek(fd, 0, SEEK_END);
+	const size_t row_size = (num_inputs + 1) * sizeof(gp_num_t);
+
+	if (size <= 0 || size % row_size != 0 || chunk_cases == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	GpDataset * ds = new(GpDataset);
+	ds->num_inputs = num_inputs;
+	ds->num_cases = size / row_size;
+	ds->capacity = ds->num_cases;
+	ds->chunk_cases = umin(chunk_cases, ds->num_cases);
+	ds->num_chunks = (ds->num_cases + ds->chunk_cases - 1) / ds->chunk_cases;
+	ds->rows = NULL;
+	ds->_cursor = 0;
+	ds->_first = 0;
+	ds->_window = 0;
+
+	struct GpStream_ * st = new(struct GpStream_);
+	memset(st, 0, sizeof(struct GpStream_));
+	st->fd = fd;
+	ds->_stream = st;
+
+	// Everything fits in one chunk: read it once and treat the dataset as
+	// if it had been built in memory.
+	if (ds->num_chunks <= 1) {
+		ds->rows = new_array(gp_num_t, (size_t)ds->num_cases * (num_inputs + 1));
+		_read_rows(ds, ds->rows, 0, ds->num_cases);
+		close(fd);
+		delete(st);
+		ds->_stream = NULL;
+		return ds;
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	st->bufs[0] = new_array(gp_num_t, (size_t)ds->chunk_cases * (num_inputs + 1));
+	st->bufs[1] = new_array(gp_num_t, (size_t)ds->chunk_cases * (num_inputs + 1));
+	pthread_mutex_init(&st->lock, NULL);
+	pthread_cond_init(&st->cond, NULL);
+	pthread_create(&st->thread, NULL, &_prefetch_thread, ds);
+
+	return ds;
+}
+
+void gp_dataset_delete(GpDataset * ds)
+{
+	struct GpStream_ * st = ds->_stream;
+
+	if (st != NULL) {
+		pthread_mutex_lock(&st->lock);
+		st->stop = 1;
+		pthread_cond_broadcast(&st->cond);
+		pthread_mutex_unlock(&st->lock);
+		pthread_join(st->thread, NULL);
+
+		pthread_mutex_destroy(&st->lock);
+		pthread_cond_destroy(&st->cond);
+		close(st->fd);
+		delete(st->bufs[0]);
+		delete(st->bufs[1]);
+		delete(st);
+	}
+
+	delete(ds->rows);
+	delete(ds);
+}
+
+// Storage row `i` of an in-memory dataset
+gp_num_t * gp_dataset_row(GpDataset * ds, uint i)
+{
+	return ds->rows + (size_t)i * (ds->num_inputs + 1);
+}
+
+// Storage row holding case `i`, counting from the oldest case in a window
+uint gp_dataset_slot(GpDataset * ds, uint i)
+{
+	return (ds->_first + i) % ds->capacity;
+}
+
+// Append `count` rows to a window dataset, overwriting the oldest cases
+// once it is full.
+void gp_dataset_append(GpDataset * ds, const gp_num_t * rows, uint count)
+{
+	const uint stride = ds->num_inputs + 1;
+
+	if (!ds->_window)
+		_dataset_err("cases can only be appended to a window dataset");
+
+	if (count > ds->capacity) {
+		rows += (size_t)(count - ds->capacity) * stride;
+		count = ds->capacity;
+	}
+
+	if (ds->num_cases + count > ds->capacity)
+		gp_dataset_retire(ds, ds->num_cases + count - ds->capacity);
+
+	for (uint i = 0; i < count; i++)
+		memcpy(gp_dataset_row(ds, gp_dataset_slot(ds, ds->num_cases + i)),
+			rows + (size_t)i * stride, stride * sizeof(gp_num_t));
+
+	ds->num_cases += count;
+}
+
+// Drop the `count` oldest cases from a window dataset
+void gp_dataset_retire(GpDataset * ds, uint count)
+{
+	count = umin(count, ds->num_cases);
+	ds->_first = gp_dataset_slot(ds, count);
+	ds->num_cases -= count;
+}
+
+//
+// `gp_dataset_next_chunk` walks the dataset one chunk at a time. It points
+// `rows` at the next chunk and returns its row count, or returns 0 once
+// every chunk has been visited, after which the next call starts over at
+// the first chunk. The previous chunk's rows are invalidated by each call.
+//
+uint gp_dataset_next_chunk(GpDataset * ds, gp_num_t ** rows)
+{
+	struct GpStream_ * st = ds->_stream;
+	const uint idx = ds->_cursor;
+
+	// In memory, the cursor counts cases. Chunks never cross the end of
+	// the storage, so a window that wraps around is returned in two parts.
+	if (st == NULL)
+	{
+		if (idx >= ds->num_cases) {
+			ds->_cursor = 0;
+			return 0;
+		}
+		const uint slot = gp_dataset_slot(ds, idx);
+		const uint count = umin(umin(ds->chunk_cases, ds->num_cases - idx),
+			ds->capacity - slot);
+		ds->_cursor += count;
+		*rows = gp_dataset_row(ds, slot);
+		return count;
+	}
+
+	pthread_mutex_lock(&st->lock);
+
+	// Hand the previous chunk's buffer back to the prefetch thread
+	for (int b = 0; b < 2; b++) {
+		if (st->state[b] == GP_CHUNK_IN_USE) {
+			st->state[b] = GP_CHUNK_FREE;
+			pthread_cond_broadcast(&st->cond);
+		}
+	}
+
+	if (idx >= ds->num_chunks) {
+		ds->_cursor = 0;
+		pthread_mutex_unlock(&st->lock);
+		return 0;
+	}
+
+	int b;
+	for (;;) {
+		for (b = 0; b < 2; b++)
+			if (st->state[b] == GP_CHUNK_READY && st->chunk[b] == idx)
+				break;
+		if (b < 2)
+			break;
+		pthread_cond_wait(&st->cond, &st->lock);
+	}
+
+	st->state[b] = GP_CHUNK_IN_USE;
+	ds->_cursor++;
+	pthread_mutex_unlock(&st->lock);
+
+	*rows = st->bufs[b];
+	return st->count[b];
+}
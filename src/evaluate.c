@@ -0,0 +1,718 @@
+//
+// _evaluate.c_ contains the built-in dataset evaluator and the functions
+// used to score programs, singly or in batches, on all of the dataset or
+// on a sampled subset of its cases.
+//
+
+#include "gp.h"
+#include "mem.h"
+#include "iqsort.h"
+#include "evaluate.h"
+#include "evolve.h"
+#include "pool.h"
+
+#include <math.h>
+
+// Rows scored by every program of a batch before moving on
+#define GP_EVAL_TILE 256
+
+// Rows in each part of a program's cases when they are split across
+// threads. Parts don't depend on the number of threads, and their totals
+// are added up in order, so a program's fitness is the same on any number
+// of them.
+#define GP_SPLIT_ROWS 8192
+
+static void _window_err(GpWorld * world)
+{
+	if (world->_error_totals == NULL) {
+		printf("libgp ERROR: cases can only be changed in a world evolving against a window dataset\n");
+		abort();
+	}
+}
+
+//
+// Add to `total` the error of `program` over `count` consecutive rows,
+// starting at storage row `slot`. When the world caches per-case errors,
+// each case's error is also recorded (and the total is built from the
+// rounded values, so cached errors can later be subtracted from it
+// exactly). Errors are added one row at a time in case order, so a total
+// is bit-identical however the rows are tiled. Programs that split their
+// cases add up a total per part instead, which rounds differently, but
+// not with the number of threads.
+//
+static gp_fitness_t _rows_error(GpWorld * world, GpProgram * program,
+	gp_num_t * rows, uint slot, uint count, gp_fitness_t total)
+{
+	const uint stride = world->conf.num_inputs + 1;
+	uint i;
+
+	if (world->_case_errors == NULL || program->id >= world->conf.population_size)
+	{
+		for (i = 0; i < count; i++)
+			total += gp_case_error(world, program, rows + i * stride);
+		return total;
+	}
+
+	float * errors = world->_case_errors + (size_t)slot * world->conf.population_size + program->id;
+	for (i = 0; i < count; i++) {
+		const float err = (float)gp_case_error(world, program, rows + i * stride);
+		errors[(size_t)i * world->conf.population_size] = err;
+		total += err;
+	}
+	return total;
+}
+
+// Total error over every row of an in-memory dataset. Unlike walking its
+// chunks, this keeps no state in the dataset, so threads can share it.
+static gp_fitness_t _memory_error(GpWorld * world, GpProgram * program)
+{
+	GpDataset * ds = world->conf.dataset;
+	const uint first = ds->_first;
+	const uint head = umin(ds->num_cases, ds->capacity - first);
+
+	const gp_fitness_t total = _rows_error(world, program, gp_dataset_row(ds, first), first, head, 0);
+	return _rows_error(world, program, gp_dataset_row(ds, 0), 0, ds->num_cases - head, total);
+}
+
+typedef struct {
+	GpWorld * world;
+	GpProgram * program;
+	gp_fitness_t * partials;
+} _Split;
+
+// Whether `program` runs long enough over the dataset to split its cases
+static inline int _splits(GpWorld * world, GpProgram * program)
+{
+	GpDataset * ds = world->conf.dataset;
+	return world->conf.split_threshold > 0 && ds->_stream == NULL
+		&& (ulong)ds->num_cases * program->num_stmts >= world->conf.split_threshold;
+}
+
+static void _split_task(void * arg, uint part)
+{
+	_Split * split = arg;
+	GpWorld * world = split->world;
+	GpDataset * ds = world->conf.dataset;
+	const uint first = part * GP_SPLIT_ROWS;
+	const uint count = umin(GP_SPLIT_ROWS, ds->num_cases - first);
+
+	// A part may wrap around the end of a window's storage
+	const uint slot = gp_dataset_slot(ds, first);
+	const uint head = umin(count, ds->capacity - slot);
+	const gp_fitness_t total = _rows_error(world, split->program, gp_dataset_row(ds, slot), slot, head, 0);
+	split->partials[part] = _rows_error(world, split->program, gp_dataset_row(ds, 0), 0, count - head, total);
+}
+
+// Total error of a single program over an in-memory dataset, its cases
+// split into parts scored in parallel on the world's pool
+static gp_fitness_t _split_error(GpWorld * world, GpProgram * program)
+{
+	const uint num_parts = (world->conf.dataset->num_cases + GP_SPLIT_ROWS - 1) / GP_SPLIT_ROWS;
+	_Split split = { world, program, new_array(gp_fitness_t, num_parts) };
+	gp_fitness_t total = 0;
+	uint i;
+
+	if (world->_pool != NULL)
+		gp_pool_run(world->_pool, &_split_task, &split, num_parts);
+	else for (i = 0; i < num_parts; i++)
+		_split_task(&split, i);
+
+	for (i = 0; i < num_parts; i++)
+		total += split.partials[i];
+	delete(split.partials);
+	return total;
+}
+
+// Storage row of the first row in an in-memory chunk
+static inline uint _chunk_slot(GpDataset * ds, gp_num_t * rows)
+{
+	return ds->rows == NULL ? 0 : (uint)((rows - ds->rows) / (ds->num_inputs + 1));
+}
+
+static inline gp_fitness_t _rmse(gp_fitness_t total, uint num_cases)
+{
+	return num_cases == 0 ? 0 : sqrt(gp_max(total, 0) / num_cases);
+}
+
+// Record a program's total error over the dataset, and the fitness it implies
+static inline void _set_total(GpWorld * world, GpProgram * program, gp_fitness_t total)
+{
+	if (world->_error_totals != NULL && program->id < world->conf.population_size)
+		world->_error_totals[program->id] = total;
+	program->fitness = _rmse(total, world->conf.dataset->num_cases);
+	program->evaluated = 1;
+}
+
+// Fitness over the `count` storage rows listed in `cases`
+gp_fitness_t gp_cases_fitness(GpWorld * world, GpProgram * program, const uint * cases, uint count)
+{
+	GpDataset * ds = world->conf.dataset;
+	gp_fitness_t total = 0;
+
+	for (uint i = 0; i < count; i++)
+		total += gp_case_error(world, program, gp_dataset_row(ds, cases[i]));
+
+	return _rmse(total, count);
+}
+
+// Fitness over every case, whatever the world samples
+gp_fitness_t gp_full_fitness(GpWorld * world, GpProgram * program)
+{
+	GpDataset * ds = world->conf.dataset;
+	gp_fitness_t total = 0;
+	gp_num_t * rows;
+	uint count, i;
+
+	if (ds->_stream == NULL) {
+		for (i = 0; i < ds->num_cases; i++)
+			total += gp_case_error(world, program, gp_dataset_row(ds, gp_dataset_slot(ds, i)));
+		return _rmse(total, ds->num_cases);
+	}
+
+	while ((count = gp_dataset_next_chunk(ds, &rows)) > 0)
+		for (i = 0; i < count; i++)
+			total += gp_case_error(world, program, rows + i * (ds->num_inputs + 1));
+
+	return _rmse(total, ds->num_cases);
+}
+
+//
+// `gp_dataset_evaluate` is the built-in evaluator used when a world is
+// configured with a `dataset` and no `evaluator`. Fitness is the root mean
+// squared error of register 0 against each row's target.
+//
+gp_fitness_t gp_dataset_evaluate(GpWorld * world, GpProgram * program)
+{
+	GpDataset * ds = world->conf.dataset;
+	gp_fitness_t total = 0;
+	gp_num_t * rows;
+	uint count;
+
+	if (world->_sample.cases != NULL)
+		return gp_cases_fitness(world, program, world->_sample.cases, world->_sample.size);
+
+	if (ds->_stream == NULL)
+		total = _splits(world, program) ? _split_error(world, program) : _memory_error(world, program);
+	else
+		while ((count = gp_dataset_next_chunk(ds, &rows)) > 0)
+			total = _rows_error(world, program, rows, _chunk_slot(ds, rows), count, total);
+
+	if (world->_error_totals != NULL && program->id < world->conf.population_size)
+		world->_error_totals[program->id] = total;
+
+	return _rmse(total, ds->num_cases);
+}
+
+// Add each program's error over `rows_count` consecutive rows to its total,
+// a tile of rows at a time
+static void _tiles_error(GpWorld * world, GpProgram ** programs, uint count,
+	gp_num_t * rows, uint slot, uint rows_count, gp_fitness_t * totals)
+{
+	for (uint first = 0; first < rows_count; first += GP_EVAL_TILE) {
+		const uint n = umin(GP_EVAL_TILE, rows_count - first);
+		gp_num_t * tile = rows + (size_t)first * (world->conf.num_inputs + 1);
+		for (uint i = 0; i < count; i++)
+			totals[i] = _rows_error(world, programs[i], tile, slot + first, n, totals[i]);
+	}
+}
+
+gp_fitness_t gp_batch_evaluate_one(GpWorld * world, GpProgram * program)
+{
+	gp_fitness_t fitness;
+	world->conf.batch_evaluator(world, &program, 1, &fitness);
+	return fitness;
+}
+
+typedef struct {
+	GpWorld * world;
+	GpProgram ** programs;
+} _Batch;
+
+static void _evaluate_task(void * arg, uint i)
+{
+	_Batch * batch = arg;
+	GpProgram * program = batch->programs[i];
+	program->fitness = batch->world->conf.evaluator(batch->world, program);
+	program->evaluated = 1;
+}
+
+// Score programs with the built-in evaluator over an in-memory dataset.
+// The dataset's chunk cursor is left alone, so that worlds on other
+// threads can share the dataset.
+static void _evaluate_memory(GpWorld * world, GpProgram ** programs, uint count)
+{
+	GpDataset * ds = world->conf.dataset;
+	GpProgram ** rest = new_array(GpProgram *, count);
+	uint n = 0, i;
+
+	for (i = 0; i < count; i++) {
+		if (_splits(world, programs[i]))
+			_set_total(world, programs[i], _split_error(world, programs[i]));
+		else
+			rest[n++] = programs[i];
+	}
+
+	if (world->_pool != NULL && n > 1)
+	{
+		_Batch batch = { world, rest };
+		gp_pool_run(world->_pool, &_evaluate_task, &batch, n);
+	}
+	else
+	{
+		const uint first = ds->_first;
+		const uint head = umin(ds->num_cases, ds->capacity - first);
+		gp_fitness_t * totals = new_array(gp_fitness_t, n);
+
+		for (i = 0; i < n; i++)
+			totals[i] = 0;
+		_tiles_error(world, rest, n, gp_dataset_row(ds, first), first, head, totals);
+		_tiles_error(world, rest, n, gp_dataset_row(ds, 0), 0, ds->num_cases - head, totals);
+		for (i = 0; i < n; i++)
+			_set_total(world, rest[i], totals[i]);
+
+		delete(totals);
+	}
+
+	delete(rest);
+}
+
+//
+// `gp_world_evaluate` scores `count` programs at once. With the built-in
+// dataset evaluator the loop is ordered chunk-major, so the dataset is
+// walked (or, when streamed, read from disk) a single time for the whole
+// batch rather than once per program. Chunks are further split into tiles
+// of `GP_EVAL_TILE` rows, which stay in cache while every program runs
+// over them.
+//
+// With a thread pool, the programs are instead scored in parallel, one per
+// evaluator call, unless the dataset is streamed. Programs long enough to
+// split their cases are taken out first and scored one at a time, each
+// across the pool.
+//
+// A `batch_evaluator` gets the whole group in a single call, and is left
+// to score it however it likes. It is called for the initial population,
+// each step's offspring and each generation's children. Like `evaluator`,
+// it must be safe to call from several threads at once when the world
+// evolves in parallel.
+//
+void gp_world_evaluate(GpWorld * world, GpProgram ** programs, uint count)
+{
+	GpDataset * ds = world->conf.dataset;
+	uint i;
+
+	if (world->conf.batch_evaluator != NULL)
+	{
+		gp_fitness_t * fitness = new_array(gp_fitness_t, count);
+		world->conf.batch_evaluator(world, programs, count, fitness);
+		for (i = 0; i < count; i++) {
+			programs[i]->fitness = fitness[i];
+			programs[i]->evaluated = 1;
+		}
+		delete(fitness);
+		return;
+	}
+
+	if (world->conf.evaluator == &gp_dataset_evaluate && world->_sample.cases == NULL
+		&& ds->_stream == NULL)
+	{
+		_evaluate_memory(world, programs, count);
+		return;
+	}
+
+	if (world->_pool != NULL && count > 1 && (ds == NULL || ds->_stream == NULL))
+	{
+		_Batch batch = { world, programs };
+		gp_pool_run(world->_pool, &_evaluate_task, &batch, count);
+		return;
+	}
+
+	if (world->conf.evaluator != &gp_dataset_evaluate)
+	{
+		for (i = 0; i < count; i++) {
+			programs[i]->fitness = world->conf.evaluator(world, programs[i]);
+			programs[i]->evaluated = 1;
+		}
+		return;
+	}
+
+	if (world->_sample.cases != NULL)
+	{
+		for (i = 0; i < count; i++) {
+			programs[i]->fitness = gp_cases_fitness(world, programs[i], world->_sample.cases, world->_sample.size);
+			programs[i]->evaluated = 1;
+		}
+		return;
+	}
+
+	gp_fitness_t * totals = new_array(gp_fitness_t, count);
+	gp_num_t * rows;
+	uint rows_count;
+
+	for (i = 0; i < count; i++)
+		totals[i] = 0;
+	while ((rows_count = gp_dataset_next_chunk(ds, &rows)) > 0)
+		_tiles_error(world, programs, count, rows, _chunk_slot(ds, rows), rows_count, totals);
+
+	for (i = 0; i < count; i++)
+		_set_total(world, programs[i], totals[i]);
+
+	delete(totals);
+}
+
+// Evaluate every offspring whose evaluation has been deferred
+void gp_world_flush_pending(GpWorld * world)
+{
+	if (world->_num_pending == 0)
+		return;
+
+	gp_world_evaluate(world, world->_pending, world->_num_pending);
+	world->_num_pending = 0;
+}
+
+//
+// `gp_world_evaluate_lazy` scores, all together, those of the `count`
+// programs in `progs` that lazy evaluation has left unscored. `buf` needs
+// room for `count` pointers. A program listed twice is scored once.
+//
+void gp_world_evaluate_lazy(GpWorld * world, GpProgram ** progs, uint count, GpProgram ** buf)
+{
+	uint n = 0;
+
+	for (uint i = 0; i < count; i++)
+		if (!progs[i]->evaluated) {
+			progs[i]->evaluated = 1;
+			buf[n++] = progs[i];
+		}
+
+	gp_world_evaluate(world, buf, n);
+}
+
+// Recompute every program's fitness from its cached total error
+static void _refresh_fitness(GpWorld * world)
+{
+	for (uint i = 0; i < world->conf.population_size; i++) {
+		GpProgram * program = world->programs + i;
+		program->fitness = _rmse(world->_error_totals[program->id], world->conf.dataset->num_cases);
+	}
+}
+
+//
+// `gp_world_retire_cases` drops the `count` oldest cases from the world's
+// window dataset. Each program's cached error on those cases is subtracted
+// from its total, so no program is rerun.
+//
+void gp_world_retire_cases(GpWorld * world, uint count)
+{
+	GpDataset * ds = world->conf.dataset;
+	const uint popsize = world->conf.population_size;
+
+	_window_err(world);
+	count = umin(count, ds->num_cases);
+
+	for (uint i = 0; i < count; i++) {
+		const float * errors = world->_case_errors + (size_t)gp_dataset_slot(ds, i) * popsize;
+		for (uint id = 0; id < popsize; id++)
+			world->_error_totals[id] -= errors[id];
+	}
+
+	gp_dataset_retire(ds, count);
+	_refresh_fitness(world);
+}
+
+//
+// `gp_world_append_cases` adds `count` rows to the world's window dataset,
+// retiring the oldest cases if the window would overflow. Only the new
+// cases are run, so updating the population costs O(new cases) per
+// program no matter how large the window is. Offspring created afterwards
+// are scored on the whole current window.
+//
+void gp_world_append_cases(GpWorld * world, const gp_num_t * rows, uint count)
+{
+	GpDataset * ds = world->conf.dataset;
+	const uint stride = ds->num_inputs + 1;
+
+	_window_err(world);
+	gp_world_flush_pending(world);
+
+	if (count > ds->capacity) {
+		rows += (size_t)(count - ds->capacity) * stride;
+		count = ds->capacity;
+	}
+
+	if (ds->num_cases + count > ds->capacity)
+		gp_world_retire_cases(world, ds->num_cases + count - ds->capacity);
+
+	const uint first = ds->num_cases;
+	gp_dataset_append(ds, rows, count);
+
+	for (uint i = 0; i < world->conf.population_size; i++)
+	{
+		GpProgram * program = world->programs + i;
+		uint done = 0;
+
+		// The new cases may wrap around the end of the window's storage
+		while (done < count) {
+			const uint slot = gp_dataset_slot(ds, first + done);
+			const uint n = umin(count - done, ds->capacity - slot);
+			world->_error_totals[program->id] = _rows_error(world, program,
+				gp_dataset_row(ds, slot), slot, n, world->_error_totals[program->id]);
+			done += n;
+		}
+	}
+
+	_refresh_fitness(world);
+}
+
+//
+// ## Fitness case sampling ##
+//
+// Early in a run there is little point scoring every offspring on tens of
+// thousands of cases. With a `sample_mode` other than `GP_SAMPLE_ALL` the
+// built-in evaluator only looks at `sample_size` cases, and the sample is
+// replaced every `sample_interval` steps. Each time the sample changes the
+// whole population is rescored on it, so that fitness values (and
+// `stats`) always compare programs on the same cases.
+//
+
+// How strongly dynamic subset selection favours cases that haven't been
+// sampled for a while, relative to difficult ones.
+#define GP_DSS_AGE_EXPONENT 3.5
+
+// Sample the next mini-batch of a random permutation of the cases,
+// reshuffling once every case has been used.
+static void _next_minibatch(GpWorld * world)
+{
+	const uint num_cases = world->conf.dataset->num_cases;
+	uint * order = world->_sample.order;
+
+	if (world->_sample.next + world->_sample.size > num_cases) {
+		for (uint i = num_cases - 1; i > 0; i--) {
+			const uint j = urand(0, i + 1);
+			const uint tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+		}
+		world->_sample.next = 0;
+	}
+
+	for (uint i = 0; i < world->_sample.size; i++)
+		world->_sample.cases[i] = order[world->_sample.next + i];
+	world->_sample.next += world->_sample.size;
+}
+
+typedef struct {
+	double key;
+	uint index;
+} _SampleKey;
+
+//
+// Dynamic subset selection (Gathercole & Ross). Each case is weighted by
+// its difficulty (the population's mean error on it the last time it was
+// sampled, relative to the hardest case) plus its age (the number of
+// samples since it was last included). Cases are drawn without replacement
+// in proportion to their weight.
+//
+static void _next_dss(GpWorld * world)
+{
+	const uint num_cases = world->conf.dataset->num_cases;
+	const double epoch = (double)num_cases / world->_sample.size;
+	_SampleKey * keys = new_array(_SampleKey, num_cases);
+	float max_difficulty = 0;
+	uint i;
+
+	for (i = 0; i < num_cases; i++)
+		max_difficulty = gp_max(max_difficulty, world->_sample.difficulty[i]);
+
+	for (i = 0; i < num_cases; i++)
+	{
+		const float d = world->_sample.difficulty[i];
+		const double difficulty = d < 0 || max_difficulty <= 0 ? 1.0 : d / max_difficulty;
+		const double weight = difficulty
+			+ pow(world->_sample.age[i] / epoch, GP_DSS_AGE_EXPONENT) + 1e-6;
+
+		// Weighted sampling without replacement: keep the largest u^(1/w)
+		keys[i].key = log(rand_double() + 1e-300) / weight;
+		keys[i].index = i;
+		world->_sample.age[i]++;
+	}
+
+#define KEY_GT(a, b) ((a)->key > (b)->key)
+	QSORT(_SampleKey, keys, num_cases, KEY_GT);
+#undef KEY_GT
+
+	for (i = 0; i < world->_sample.size; i++) {
+		world->_sample.cases[i] = keys[i].index;
+		world->_sample.age[keys[i].index] = 0;
+	}
+
+	delete(keys);
+}
+
+//
+// `gp_world_resample` replaces the current case sample and rescores every
+// program on the new one. It is called automatically every
+// `sample_interval` steps.
+//
+void gp_world_resample(GpWorld * world)
+{
+	GpDataset * ds = world->conf.dataset;
+	const uint size = world->_sample.size;
+
+	if (world->_sample.cases == NULL)
+		return;
+
+	if (world->conf.sample_mode == GP_SAMPLE_DSS)
+		_next_dss(world);
+	else if (world->conf.sample_mode == GP_SAMPLE_PREDICTORS) {
+		if (!gp_predictors_next(world))
+			return;
+	}
+	else
+		_next_minibatch(world);
+
+	gp_fitness_t * case_totals = new_array(gp_fitness_t, size);
+	uint i, j;
+
+	for (j = 0; j < size; j++)
+		case_totals[j] = 0;
+
+	for (i = 0; i < world->conf.population_size; i++)
+	{
+		GpProgram * program = world->programs + i;
+		gp_fitness_t total = 0;
+
+		for (j = 0; j < size; j++) {
+			const gp_fitness_t err = gp_case_error(world, program, gp_dataset_row(ds, world->_sample.cases[j]));
+			case_totals[j] += err;
+			total += err;
+		}
+
+		program->fitness = _rmse(total, size);
+		program->evaluated = 1;
+	}
+
+	for (j = 0; j < size; j++)
+		world->_sample.difficulty[world->_sample.cases[j]] =
+			case_totals[j] / world->conf.population_size;
+
+	delete(case_totals);
+}
+
+//
+// `gp_world_rescore_top` scores the first `count` programs (which are the
+// best ones, once sorted) on the full dataset, moves the truly best of
+// them to the front, and returns its full-dataset fitness. Their `fitness`
+// is left as the sample score, so tournaments stay consistent.
+//
+gp_fitness_t gp_world_rescore_top(GpWorld * world, uint count)
+{
+	const int minimize = world->conf.minimize_fitness;
+	gp_fitness_t best = 0;
+	uint best_i = 0;
+
+	count = umin(count, world->conf.population_size);
+
+	for (uint i = 0; i < count; i++)
+	{
+		const gp_fitness_t fitness = gp_full_fitness(world, world->programs + i);
+		if (i == 0 || (minimize ? fitness < best : fitness > best)) {
+			best = fitness;
+			best_i = i;
+		}
+	}
+
+	if (best_i != 0) {
+		GpProgram tmp = world->programs[0];
+		world->programs[0] = world->programs[best_i];
+		world->programs[best_i] = tmp;
+		// Cellular grids and shared tournaments find programs by id
+		if (world->_id_slots != NULL) {
+			world->_id_slots[world->programs[0].id] = 0;
+			world->_id_slots[world->programs[best_i].id] = best_i;
+		}
+	}
+
+	return best;
+}
+
+//
+// ## Two-stage screening ##
+//
+// Most offspring are clearly worse than the programs they replace. With
+// `screen_cases` set, offspring are first scored on a copy of an evenly
+// strided subset of the dataset, its values rounded to float32. Only those
+// whose screening score comes within `screen_margin` (relative) of beating
+// the tournament's losers are rescored by the full-precision evaluator;
+// the rest keep their screening score and are flagged `approximate`.
+//
+// Programs run in `gp_num_t` whatever their data, so the rounding saves
+// no time. The saving is the smaller subsample, which a batch of
+// offspring runs over a tile at a time, as `gp_world_evaluate` does.
+//
+
+void gp_screen_init(GpWorld * world)
+{
+	GpDataset * ds = world->conf.dataset;
+	const uint stride = ds->num_inputs + 1;
+	const uint count = umin(world->conf.screen_cases, ds->num_cases);
+
+	world->conf.screen_cases = count;
+	world->_screen_rows = new_array(gp_num_t, (size_t)count * stride);
+
+	for (uint i = 0; i < count; i++) {
+		const gp_num_t * row = gp_dataset_row(ds, (uint)((size_t)i * ds->num_cases / count));
+		for (uint j = 0; j < stride; j++)
+			world->_screen_rows[(size_t)i * stride + j] = (float)row[j];
+	}
+}
+
+//
+// `gp_screen_evaluate` scores `count` offspring, each of which has to beat
+// the matching entry of `thresholds`. Only those whose screening score
+// comes within the margin of it are passed on to the full evaluator.
+// Returns how many were not.
+//
+uint gp_screen_evaluate(GpWorld * world, GpProgram ** programs, const gp_fitness_t * thresholds, uint count)
+{
+	gp_fitness_t totals[count];
+	uint skipped = 0;
+	uint i;
+
+	// Screening rules out the per-case error caches, so nothing is
+	// recorded against the storage rows
+	for (i = 0; i < count; i++)
+		totals[i] = 0;
+	_tiles_error(world, programs, count, world->_screen_rows, 0, world->conf.screen_cases, totals);
+
+	for (i = 0; i < count; i++)
+	{
+		GpProgram * program = programs[i];
+		const gp_fitness_t estimate = _rmse(totals[i], world->conf.screen_cases);
+
+		program->evaluated = 1;
+		program->approximate = !gp_within_margin(world, estimate, thresholds[i]);
+		if (program->approximate) {
+			program->fitness = estimate;
+			skipped++;
+		} else
+			program->fitness = world->conf.evaluator(world, program);
+	}
+	return skipped;
+}
+
+// Give the first `count` programs full-precision scores. Returns nonzero
+// if any of them only had a screening score.
+int gp_screen_confirm_top(GpWorld * world, uint count)
+{
+	int changed = 0;
+
+	count = umin(count, world->conf.population_size);
+	for (uint i = 0; i < count; i++)
+	{
+		GpProgram * program = world->programs + i;
+		if (program->approximate) {
+			program->fitness = world->conf.evaluator(world, program);
+			program->approximate = 0;
+			changed = 1;
+		}
+	}
+	return changed;
+}
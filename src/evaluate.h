@@ -0,0 +1,69 @@
+
+#ifndef __EVALUATE_H__
+#define __EVALUATE_H__
+
+//
+// Helpers shared by the evaluation sources (_evaluate.c_ and
+// _predictor.c_). These are not part of the public interface.
+//
+
+#include "gp.h"
+
+// Squared error of one fitness case, clamped so a single wild output
+// can't overflow the total.
+static inline gp_fitness_t gp_case_error(GpWorld * world, GpProgram * program, gp_num_t * row)
+{
+	GpState state = gp_program_run(world, program, row);
+	const gp_num_t err = state.registers[0] - row[world->conf.num_inputs];
+	return gp_min(err * err, 999999999);
+}
+
+// Whether `fitness` comes within `screen_margin` (relative) of beating
+// `threshold`
+static inline int gp_within_margin(GpWorld * world, gp_fitness_t fitness, gp_fitness_t threshold)
+{
+	const float margin = world->conf.screen_margin;
+	return world->conf.minimize_fitness ?
+		fitness <= threshold * (1 + margin) :
+		fitness >= threshold * (1 - margin);
+}
+
+// Scores a single program through `batch_evaluator`
+gp_fitness_t gp_batch_evaluate_one (GpWorld *, GpProgram *);
+
+// Root mean squared error of `program` on the listed storage rows
+gp_fitness_t gp_cases_fitness (GpWorld *, GpProgram *, const uint *, uint);
+
+// Root mean squared error of `program` on every case, ignoring any sample
+gp_fitness_t gp_full_fitness  (GpWorld *, GpProgram *);
+
+// Fitness predictors (see _predictor.c_)
+void         gp_predictors_init   (GpWorld *);
+int          gp_predictors_next   (GpWorld *);
+void         gp_predictors_delete (GpWorld *);
+
+// Rescore the best programs on the whole dataset (see _evaluate.c_)
+gp_fitness_t gp_world_rescore_top (GpWorld *, uint);
+
+// Two-stage screening of offspring (see _evaluate.c_)
+void         gp_screen_init       (GpWorld *);
+uint         gp_screen_evaluate   (GpWorld *, GpProgram **, const gp_fitness_t *, uint);
+int          gp_screen_confirm_top(GpWorld *, uint);
+
+// Surrogate fitness model (see _surrogate.c_)
+void         gp_surrogate_init    (GpWorld *);
+uint         gp_surrogate_evaluate(GpWorld *, GpProgram **, const gp_fitness_t *, uint);
+float        gp_surrogate_accuracy(GpWorld *);
+void         gp_surrogate_delete  (GpWorld *);
+
+// Evaluator worker processes (see _procs.c_)
+void         gp_procs_init        (GpWorld *);
+void         gp_procs_evaluate    (GpWorld *, GpProgram **, uint, gp_fitness_t *);
+void         gp_procs_delete      (GpWorld *);
+
+// Remote evaluator nodes (see _farm.c_)
+void         gp_farm_init         (GpWorld *);
+void         gp_farm_evaluate     (GpWorld *, GpProgram **, uint, gp_fitness_t *);
+void         gp_farm_delete       (GpWorld *);
+
+#endif
@@ -0,0 +1,100 @@
+
+#ifndef __EVOLVE_H__
+#define __EVOLVE_H__
+
+//
+// Pieces of the evolutionary algorithms shared between the serial
+// steady-state loop in _world.c_, the multithreaded ones and the
+// generational one. Not part of the public interface.
+//
+
+#include "gp.h"
+
+// Event counts gathered by one thread, merged into `world->stats` when the
+// run ends. Keeping them per thread avoids bouncing a shared cache line
+// between cores on every step.
+typedef struct {
+	uint steps;
+	uint screened;
+} GpCounters;
+
+// What a counter-based random stream is used for (see `gp_rand_stream`)
+enum {
+	GP_STREAM_INIT = 0,
+	GP_STREAM_SELECT,
+	GP_STREAM_VARY
+};
+
+// Make the calling thread draw from the world's own generator
+static inline void gp_world_use_rand(GpWorld * world)
+{
+	_gp_rng = &world->_rand;
+}
+
+// Sort the four programs of a tournament, best first
+static inline void gp_tournament_sort(GpWorld * world, GpProgram ** progs)
+{
+	// Fast sort for 4 elements.
+	// Note: calling min and max to swap elements may seem inefficient, but
+	// gcc will detect this sequence and use extremely fast conditional move
+	// instructions. If we try to optimize this, it will become much slower.
+	// see: http://stackoverflow.com/questions/2786899/
+
+#define min(x,y) (x->fitness < y->fitness ? x : y)
+#define max(x,y) (x->fitness < y->fitness ? y : x)
+
+	if (world->conf.minimize_fitness) {
+#define SWAP(x,y) {	GpProgram * tmp = min(progs[x], progs[y]); progs[y] = max(progs[x], progs[y]); progs[x] = tmp; }
+	SWAP(0, 1);
+	SWAP(2, 3);
+	SWAP(0, 2);
+	SWAP(1, 3);
+	SWAP(1, 2);
+#undef SWAP
+	} else {
+#define SWAP(x,y) { GpProgram * tmp = max(progs[x], progs[y]); progs[y] = min(progs[x], progs[y]); progs[x] = tmp; }
+	SWAP(0, 1);
+	SWAP(2, 3);
+	SWAP(0, 2);
+	SWAP(1, 3);
+	SWAP(1, 2);
+#undef SWAP
+	}
+
+#undef max
+#undef min
+}
+
+gp_fitness_t gp_world_breed  (GpWorld *, GpProgram **, GpCounters *);
+void gp_world_vary          (GpWorld *, GpProgram **);
+void gp_world_tournament    (GpWorld *, GpProgram **, GpCounters *);
+void gp_world_sort_programs (GpWorld *);
+void gp_world_process_stats (GpWorld *);
+void gp_world_evolve_generation (GpWorld *);
+int  gp_world_evolve_pipelined  (GpWorld *, uint, float);
+void gp_world_cells_init        (GpWorld *);
+void gp_world_evolve_cellular   (GpWorld *);
+void gp_world_evolve_async      (GpWorld *, uint, float);
+void gp_world_evaluate_lazy     (GpWorld *, GpProgram **, uint, GpProgram **);
+
+// Scoring of the initial population in the background (see _background.c_)
+void gp_background_start  (GpWorld *, int);
+uint gp_background_scored (GpWorld *, uint);
+void gp_background_finish (GpWorld *);
+
+// Compact program encoding (see _program.c_), shared by linked processes
+// and worker processes. Largest encoding of a statement:
+#define GP_STMT_BYTES (2 + GP_MAX_ARGS * (1 + sizeof(gp_num_t)))
+
+// Ops and inputs a world may have for its programs to be encoded
+#define GP_ENCODE_MAX_OPS    256
+#define GP_ENCODE_MAX_INPUTS 65536
+
+uint gp_program_encode (GpWorld *, GpProgram *, uint8_t *);
+int  gp_program_decode (GpWorld *, const uint8_t *, uint, GpProgram *);
+
+// Island topologies, shared by archipelagos and linked processes
+uint gp_topology_neighbour (GpTopology, uint, uint, uint, uint);
+uint gp_topology_width     (uint, uint);
+
+#endif
@@ -0,0 +1,667 @@
+//
+// _farm.c_ spreads evaluation over evaluator nodes on other machines (or
+// the same one), used when `farm_workers` lists their addresses, such as
+// `"unix:/tmp/gp.sock,host1:7000,host2:7000"`. Each evaluator node is a
+// process that set up a world with the same config and called
+// `gp_farm_serve`. It scores programs with its own evaluator, so that
+// world needs the problem's data too.
+//
+// The protocol is a handful of fixed-size records over a stream socket,
+// in the byte order of the machines, which must agree:
+//
+// * on connecting, both sides send a hello of eight `uint32_t`: a magic
+//   number, the protocol version, `num_ops`, `num_registers`, `num_inputs`,
+//   `max_program_length` and the sizes of `gp_num_t` and `gp_fitness_t`.
+//   The connection is dropped if they differ.
+// * a job is its encoded length and a tag, both `uint32_t`, then the
+//   program in the compact encoding (see `gp_program_encode`).
+// * a result is the job's tag and its `gp_fitness_t`. Results come back
+//   in the order the jobs were sent.
+//
+// Up to `farm_window` jobs are in flight on every connection, sent in one
+// write, so a worker always has its next program at hand. A connection
+// that fails puts its unanswered jobs back to be sent elsewhere, and is
+// retried a second later. With no evaluator node up at all, programs are
+// scored locally. Nothing is timed out here: an evaluator that can hang
+// should run in worker processes with `eval_timeout` on the evaluator
+// node.
+//
+// The world hands groups of programs to the farm as its
+// `batch_evaluator`. Several threads may use the farm at once, each with
+// the connections it claims.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "gp.h"
+#include "mem.h"
+#include "evolve.h"
+#include "evaluate.h"
+#include "os.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <float.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define GP_FARM_MAGIC 0x6c67701fu
+#define GP_FARM_VERSION 1
+#define GP_FARM_HELLO 8
+
+// Seconds to wait for a hello, and before reconnecting to a failed node,
+// and milliseconds to wait for a connection to be accepted
+#define GP_FARM_HANDSHAKE 5
+#define GP_FARM_RETRY 1.0
+#define GP_FARM_CONNECT 250
+
+// Most clients an evaluator node serves at once, and jobs it scores
+// together
+#define GP_FARM_MAX_CLIENTS 64
+#define GP_FARM_MAX_BATCH 256
+
+typedef struct GpFarm_ GpFarm;
+
+typedef struct {
+	char * address;
+	int fd;
+	int connecting;
+	double retry_at;
+
+	// Tags of the jobs in flight, oldest first, and a partly read result
+	uint * jobs;
+	uint first;
+	uint count;
+	uint8_t * in;
+	uint in_count;
+} _Conn;
+
+struct GpFarm_ {
+	gp_fitness_t (*evaluator)(GpWorld *, GpProgram *);
+	_Conn * conns;
+	uint num_conns;
+	uint num_up;
+	uint * idle;
+	uint num_idle;
+	uint window;
+	pthread_mutex_t lock;
+	pthread_cond_t released;
+};
+
+static const size_t _result_size = sizeof(uint32_t) + sizeof(gp_fitness_t);
+
+static void _farm_err(const char * estr)
+{
+	printf("libgp farm ERROR: %s\n", estr);
+	abort();
+}
+
+static size_t _max_frame(GpWorld * world)
+{
+	return 2 * sizeof(uint32_t) + 2 + world->conf.max_program_length * GP_STMT_BYTES;
+}
+
+//
+// ## Sockets ##
+//
+
+// Connect `fd` to `sa`, giving up after `GP_FARM_CONNECT` milliseconds, so
+// that a node that doesn't answer holds up the retrying thread only briefly
+static int _dial(int fd, const struct sockaddr * sa, socklen_t length)
+{
+	const int flags = fcntl(fd, F_GETFL);
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+	int connected = connect(fd, sa, length) == 0;
+	if (!connected && errno == EINPROGRESS) {
+		struct pollfd pfd = { fd, POLLOUT, 0 };
+		int error = 0;
+		socklen_t size = sizeof(error);
+		connected = poll(&pfd, 1, GP_FARM_CONNECT) == 1
+			&& getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size) == 0 && error == 0;
+	}
+
+	fcntl(fd, F_SETFL, flags);
+	return connected;
+}
+
+// Open a stream socket to (or listening on) `address`, either
+// `unix:PATH` or `HOST:PORT`. Returns -1 on failure.
+static int _open(const char * address, int listening)
+{
+	int fd = -1;
+
+	if (strncmp(address, "unix:", 5) == 0)
+	{
+		struct sockaddr_un sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		if (strlen(address + 5) >= sizeof(sa.sun_path))
+			return -1;
+		strcpy(sa.sun_path, address + 5);
+
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+			return -1;
+		if (listening)
+			unlink(sa.sun_path);
+		if (listening ? bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 || listen(fd, 16) != 0
+			: !_dial(fd, (struct sockaddr *)&sa, sizeof(sa)))
+		{
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	const char * colon = strrchr(address, ':');
+	char host[256];
+	if (colon == NULL || (size_t)(colon - address) >= sizeof(host))
+		return -1;
+	memcpy(host, address, colon - address);
+	host[colon - address] = '\0';
+
+	struct addrinfo hints, * found, * ai;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = listening ? AI_PASSIVE : 0;
+	if (getaddrinfo(host[0] != '\0' ? host : NULL, colon + 1, &hints, &found) != 0)
+		return -1;
+
+	for (ai = found; ai != NULL; ai = ai->ai_next)
+	{
+		const int one = 1;
+		if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+			continue;
+		if (listening)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (listening ? bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 16) == 0
+			: _dial(fd, ai->ai_addr, ai->ai_addrlen))
+		{
+			// Jobs and results are small and sent as soon as they're ready
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(found);
+	return fd;
+}
+
+static int _send_all(int fd, const void * bytes, size_t size)
+{
+	const uint8_t * p = bytes;
+	while (size > 0) {
+		const ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return 0;
+		p += sent;
+		size -= sent;
+	}
+	return 1;
+}
+
+// Read exactly `size` bytes, giving up after `secs` seconds without any
+static int _recv_all(int fd, void * bytes, size_t size, int secs)
+{
+	uint8_t * p = bytes;
+	while (size > 0) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, secs * 1000) <= 0)
+			return 0;
+		const ssize_t got = recv(fd, p, size, 0);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return 0;
+		p += got;
+		size -= got;
+	}
+	return 1;
+}
+
+// Swap hellos with the other side. Returns 1 if their worlds agree.
+static int _handshake(GpWorld * world, int fd)
+{
+	const uint32_t mine[GP_FARM_HELLO] = {
+		GP_FARM_MAGIC, GP_FARM_VERSION,
+		world->conf.num_ops, world->conf.num_registers,
+		world->conf.num_inputs, world->conf.max_program_length,
+		sizeof(gp_num_t), sizeof(gp_fitness_t)
+	};
+	uint32_t theirs[GP_FARM_HELLO];
+
+	return _send_all(fd, mine, sizeof(mine))
+		&& _recv_all(fd, theirs, sizeof(theirs), GP_FARM_HANDSHAKE)
+		&& memcmp(mine, theirs, sizeof(mine)) == 0;
+}
+
+//
+// ## Evolution nodes ##
+//
+
+// Connect to a node that is down and due for a retry, which the caller
+// marked as `connecting`. Called without the lock, so that other threads
+// carry on with the nodes that are up meanwhile.
+static void _connect(GpWorld * world, uint i)
+{
+	GpFarm * farm = world->_farm;
+	_Conn * conn = farm->conns + i;
+
+	int fd = _open(conn->address, 0);
+	if (fd >= 0 && !_handshake(world, fd)) {
+		close(fd);
+		fd = -1;
+	}
+
+	pthread_mutex_lock(&farm->lock);
+	conn->fd = fd;
+	conn->connecting = 0;
+	if (fd < 0)
+		conn->retry_at = gp_now() + GP_FARM_RETRY;
+	else {
+		conn->first = conn->count = conn->in_count = 0;
+		farm->idle[farm->num_idle++] = i;
+		farm->num_up++;
+		pthread_cond_broadcast(&farm->released);
+	}
+	pthread_mutex_unlock(&farm->lock);
+}
+
+// Close a failed connection, putting its unanswered jobs back in `pending`
+static void _drop(GpWorld * world, uint i, uint * pending, uint * num_pending)
+{
+	GpFarm * farm = world->_farm;
+	_Conn * conn = farm->conns + i;
+
+	for (uint k = 0; k < conn->count; k++)
+		pending[(*num_pending)++] = conn->jobs[(conn->first + k) % farm->window];
+	__atomic_fetch_add(&world->stats.farm_reassigned, conn->count, __ATOMIC_RELAXED);
+
+	close(conn->fd);
+	conn->count = 0;
+
+	pthread_mutex_lock(&farm->lock);
+	conn->fd = -1;
+	conn->retry_at = gp_now() + GP_FARM_RETRY;
+	farm->num_up--;
+	pthread_cond_broadcast(&farm->released);
+	pthread_mutex_unlock(&farm->lock);
+}
+
+//
+// `gp_farm_init` connects the world to the evaluator nodes in
+// `farm_workers`, which from then on score its programs. Nodes that
+// can't be reached yet are retried later.
+//
+void gp_farm_init(GpWorld * world)
+{
+	const char * list = world->conf.farm_workers;
+	uint n = 1, i;
+
+	for (const char * c = list; *c != '\0'; c++)
+		n += *c == ',';
+
+	GpFarm * farm = new(GpFarm);
+	world->_farm = farm;
+	farm->evaluator = world->conf.evaluator;
+	farm->conns = new_array(_Conn, n);
+	farm->num_conns = n;
+	farm->num_up = 0;
+	farm->idle = new_array(uint, n);
+	farm->num_idle = 0;
+	farm->window = world->conf.farm_window;
+	pthread_mutex_init(&farm->lock, NULL);
+	pthread_cond_init(&farm->released, NULL);
+
+	for (i = 0; i < n; i++)
+	{
+		const char * end = strchr(list, ',');
+		const size_t length = end != NULL ? (size_t)(end - list) : strlen(list);
+		_Conn * conn = farm->conns + i;
+
+		conn->address = new_array(char, length + 1);
+		memcpy(conn->address, list, length);
+		conn->address[length] = '\0';
+		conn->jobs = new_array(uint, farm->window);
+		conn->in = new_array(uint8_t, farm->window * _result_size);
+		conn->fd = -1;
+		conn->connecting = 1;
+
+		_connect(world, i);
+		list += length + 1;
+	}
+
+	world->conf.batch_evaluator = &gp_farm_evaluate;
+	world->conf.evaluator = &gp_batch_evaluate_one;
+}
+
+void gp_farm_delete(GpWorld * world)
+{
+	GpFarm * farm = world->_farm;
+
+	for (uint i = 0; i < farm->num_conns; i++) {
+		_Conn * conn = farm->conns + i;
+		if (conn->fd >= 0)
+			close(conn->fd);
+		delete(conn->address);
+		delete(conn->jobs);
+		delete(conn->in);
+	}
+
+	pthread_mutex_destroy(&farm->lock);
+	pthread_cond_destroy(&farm->released);
+	delete(farm->conns);
+	delete(farm->idle);
+	delete(farm);
+}
+
+// Take the complete results out of a connection's input
+static uint _take_results(GpFarm * farm, _Conn * conn, gp_fitness_t * fitness, int * bad)
+{
+	const uint8_t * p = conn->in;
+	uint taken = 0;
+
+	while ((size_t)(conn->in_count - (p - conn->in)) >= _result_size)
+	{
+		uint32_t tag;
+		memcpy(&tag, p, sizeof(tag));
+		if (conn->count == 0 || tag != conn->jobs[conn->first]) {
+			*bad = 1;
+			return taken;
+		}
+		memcpy(fitness + tag, p + sizeof(tag), sizeof(gp_fitness_t));
+		conn->first = (conn->first + 1) % farm->window;
+		conn->count--;
+		p += _result_size;
+		taken++;
+	}
+
+	conn->in_count -= p - conn->in;
+	memmove(conn->in, p, conn->in_count);
+	return taken;
+}
+
+//
+// `gp_farm_evaluate` scores `count` programs on the evaluator nodes,
+// spreading them over the connections this call can claim, and writes
+// their fitness to `fitness`.
+//
+void gp_farm_evaluate(GpWorld * world, GpProgram ** programs, uint count, gp_fitness_t * fitness)
+{
+	GpFarm * farm = world->_farm;
+	const size_t max_frame = _max_frame(world);
+	uint * pending = new_array(uint, count);
+	uint * mine = new_array(uint, farm->num_conns);
+	uint * due = new_array(uint, farm->num_conns);
+	struct pollfd * fds = new_array(struct pollfd, farm->num_conns);
+	uint8_t * out = new_array(uint8_t, farm->window * max_frame);
+	uint num_pending = count, num_mine = 0, done = 0;
+	uint i;
+
+	// Jobs are taken from the end, so put the first one there
+	for (i = 0; i < count; i++)
+		pending[i] = count - 1 - i;
+
+	while (done < count)
+	{
+		// Reconnect to the nodes due for a retry that no other thread is
+		// already reconnecting to
+		pthread_mutex_lock(&farm->lock);
+		const double now = gp_now();
+		uint num_due = 0;
+		for (i = 0; i < farm->num_conns; i++) {
+			_Conn * conn = farm->conns + i;
+			if (conn->fd < 0 && !conn->connecting && now >= conn->retry_at) {
+				conn->connecting = 1;
+				due[num_due++] = i;
+			}
+		}
+		pthread_mutex_unlock(&farm->lock);
+		for (i = 0; i < num_due; i++)
+			_connect(world, due[i]);
+
+		// Claim a connection for every pending job, if there are enough,
+		// waiting for one only while none of ours are busy
+		pthread_mutex_lock(&farm->lock);
+		while (num_pending > 0 && num_mine == 0 && farm->num_idle == 0 && farm->num_up > 0)
+			pthread_cond_wait(&farm->released, &farm->lock);
+		while (num_mine < num_pending && farm->num_idle > 0)
+			mine[num_mine++] = farm->idle[--farm->num_idle];
+		const int alone = num_mine == 0 && num_pending > 0 && farm->num_up == 0;
+		pthread_mutex_unlock(&farm->lock);
+
+		// With no evaluator node up, score what is left here
+		if (alone) {
+			__atomic_fetch_add(&world->stats.farm_local, num_pending, __ATOMIC_RELAXED);
+			while (num_pending > 0) {
+				const uint job = pending[--num_pending];
+				fitness[job] = farm->evaluator(world, programs[job]);
+				done++;
+			}
+			continue;
+		}
+
+		// Share the pending jobs out evenly, a window at most on each
+		// connection, and send each connection's in a single write
+		const uint share = num_mine > 0 ? (num_pending + num_mine - 1) / num_mine : 0;
+		for (i = num_mine; i-- > 0; )
+		{
+			_Conn * conn = farm->conns + mine[i];
+			size_t size = 0;
+
+			for (uint k = 0; k < share && num_pending > 0 && conn->count < farm->window; k++) {
+				const uint job = pending[--num_pending];
+				uint32_t header[2];
+				header[0] = gp_program_encode(world, programs[job], out + size + sizeof(header));
+				header[1] = job;
+				memcpy(out + size, header, sizeof(header));
+				size += sizeof(header) + header[0];
+				conn->jobs[(conn->first + conn->count++) % farm->window] = job;
+			}
+
+			if (size > 0 && !_send_all(conn->fd, out, size)) {
+				_drop(world, mine[i], pending, &num_pending);
+				mine[i] = mine[--num_mine];
+			}
+		}
+
+		for (i = 0; i < num_mine; i++) {
+			fds[i].fd = farm->conns[mine[i]].fd;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+		if (num_mine > 0 && poll(fds, num_mine, -1) < 0 && errno != EINTR)
+			_farm_err("cannot wait for evaluator nodes");
+
+		for (i = num_mine; i-- > 0; )
+		{
+			_Conn * conn = farm->conns + mine[i];
+			int bad = 0;
+
+			if (fds[i].revents != 0) {
+				const ssize_t got = recv(conn->fd, conn->in + conn->in_count,
+					conn->count * _result_size - conn->in_count, 0);
+				if (got <= 0 && !(got < 0 && errno == EINTR))
+					bad = 1;
+				else if (got > 0) {
+					conn->in_count += got;
+					done += _take_results(farm, conn, fitness, &bad);
+				}
+			}
+
+			if (bad) {
+				_drop(world, mine[i], pending, &num_pending);
+				mine[i] = mine[--num_mine];
+			} else if (conn->count == 0 && num_pending == 0) {
+				pthread_mutex_lock(&farm->lock);
+				farm->idle[farm->num_idle++] = mine[i];
+				pthread_cond_broadcast(&farm->released);
+				pthread_mutex_unlock(&farm->lock);
+				mine[i] = mine[--num_mine];
+			}
+		}
+	}
+
+	// Hand back connections claimed in a round with nothing left to send
+	pthread_mutex_lock(&farm->lock);
+	for (i = 0; i < num_mine; i++)
+		farm->idle[farm->num_idle++] = mine[i];
+	pthread_cond_broadcast(&farm->released);
+	pthread_mutex_unlock(&farm->lock);
+
+	delete(pending);
+	delete(mine);
+	delete(due);
+	delete(fds);
+	delete(out);
+}
+
+//
+// ## Evaluator nodes ##
+//
+
+typedef struct {
+	int fd;
+	uint8_t * in;
+	size_t in_count;
+} _Client;
+
+// Score the complete jobs in a client's input and send back their results.
+// Returns 0 if the client misbehaved or went away.
+static int _serve_jobs(GpWorld * world, _Client * client, GpProgram * programs,
+	GpProgram ** ptrs, uint32_t * tags, uint8_t * out)
+{
+	const gp_fitness_t worst = world->conf.minimize_fitness ? FLT_MAX : -FLT_MAX;
+	const size_t max_frame = _max_frame(world);
+	const uint8_t * p = client->in;
+	uint8_t decoded[GP_FARM_MAX_BATCH];
+	uint n = 0, i;
+
+	while (n < GP_FARM_MAX_BATCH && client->in_count - (p - client->in) >= 2 * sizeof(uint32_t))
+	{
+		uint32_t header[2];
+		memcpy(header, p, sizeof(header));
+		if (header[0] > max_frame - sizeof(header))
+			return 0;
+		if (client->in_count - (p - client->in) < sizeof(header) + header[0])
+			break;
+
+		tags[n] = header[1];
+		decoded[n] = gp_program_decode(world, p + sizeof(header), header[0], programs + n);
+		p += sizeof(header) + header[0];
+		n++;
+	}
+
+	client->in_count -= p - client->in;
+	memmove(client->in, p, client->in_count);
+
+	// Score the programs that decoded together, as a local world would
+	uint m = 0;
+	for (i = 0; i < n; i++)
+		if (decoded[i])
+			ptrs[m++] = programs + i;
+	gp_world_evaluate(world, ptrs, m);
+
+	for (i = 0; i < n; i++) {
+		memcpy(out + i * _result_size, tags + i, sizeof(uint32_t));
+		memcpy(out + i * _result_size + sizeof(uint32_t), decoded[i] ? &programs[i].fitness : &worst, sizeof(gp_fitness_t));
+	}
+
+	return _send_all(client->fd, out, n * _result_size);
+}
+
+//
+// `gp_farm_serve` makes this process an evaluator node listening on
+// `address`, scoring the programs sent by evolution nodes with the world's
+// evaluator. The world must have been initialized with the same config as
+// theirs. Jobs that arrive together are scored together with
+// `gp_world_evaluate`, so an evaluator node can spread them over its own
+// worker processes (see `num_processes`). Never returns.
+//
+void gp_farm_serve(GpWorld * world, const char * address)
+{
+	const uint max_length = world->conf.max_program_length;
+	const size_t capacity = GP_FARM_MAX_BATCH * _max_frame(world);
+	_Client clients[GP_FARM_MAX_CLIENTS];
+	struct pollfd fds[GP_FARM_MAX_CLIENTS + 1];
+	uint num_clients = 0, i;
+
+	const int listener = _open(address, 1);
+	if (listener < 0)
+		_farm_err("cannot listen on the address");
+
+	GpProgram * programs = new_array(GpProgram, GP_FARM_MAX_BATCH);
+	GpStatement * stmt_buf = new_array(GpStatement, GP_FARM_MAX_BATCH * max_length);
+	GpProgram ** ptrs = new_array(GpProgram *, GP_FARM_MAX_BATCH);
+	uint32_t * tags = new_array(uint32_t, GP_FARM_MAX_BATCH);
+	uint8_t * out = new_array(uint8_t, GP_FARM_MAX_BATCH * _result_size);
+	for (i = 0; i < GP_FARM_MAX_BATCH; i++) {
+		programs[i].stmts = stmt_buf + i * max_length;
+		programs[i].id = (uint)-1;
+		programs[i]._busy = 0;
+	}
+
+	for (;;)
+	{
+		fds[0].fd = listener;
+		fds[0].events = num_clients < GP_FARM_MAX_CLIENTS ? POLLIN : 0;
+		for (i = 0; i < num_clients; i++) {
+			fds[i + 1].fd = clients[i].fd;
+			fds[i + 1].events = POLLIN;
+		}
+		if (poll(fds, num_clients + 1, -1) < 0)
+			continue;
+
+		for (i = num_clients; i-- > 0; )
+		{
+			_Client * client = clients + i;
+			if (fds[i + 1].revents == 0)
+				continue;
+
+			const ssize_t got = recv(client->fd, client->in + client->in_count, capacity - client->in_count, 0);
+			int ok = got > 0 || (got < 0 && errno == EINTR);
+			if (got > 0) {
+				client->in_count += got;
+				while (ok && client->in_count >= 2 * sizeof(uint32_t)) {
+					const size_t before = client->in_count;
+					ok = _serve_jobs(world, client, programs, ptrs, tags, out);
+					if (client->in_count == before)
+						break;
+				}
+			}
+
+			if (!ok) {
+				close(client->fd);
+				delete(client->in);
+				clients[i] = clients[--num_clients];
+			}
+		}
+
+		if (fds[0].revents & POLLIN)
+		{
+			const int fd = accept(listener, NULL, NULL);
+			if (fd < 0)
+				continue;
+			if (!_handshake(world, fd)) {
+				close(fd);
+				continue;
+			}
+			clients[num_clients].fd = fd;
+			clients[num_clients].in = new_array(uint8_t, capacity);
+			clients[num_clients].in_count = 0;
+			num_clients++;
+		}
+	}
+}
@@ -0,0 +1,180 @@
+//
+// _generation.c_ implements the generational algorithm, used when
+// `algorithm` is `GP_GENERATIONAL`. Each generation, the `num_elites` best
+// programs are carried over unchanged and the rest of a whole new
+// population is bred from the current one into a second statement buffer.
+// The buffers then swap places, so no program is copied between them.
+//
+// Breeding and scoring both run as parallel loops on the world's thread
+// pool. Every pair of children reads only the current population and
+// writes only its own two slots, so the loops need no locking.
+//
+// With `lazy_evaluation` set, children aren't scored when they are bred.
+// The next generation's tournaments are instead drawn ahead of breeding,
+// and only the programs they drew are scored, all together. About one
+// child in seven is never drawn, and is dropped without being scored.
+// The elites are picked once the drawn programs are scored, and any
+// program still unscored by then counts as the worst.
+//
+
+#include "gp.h"
+#include "mem.h"
+#include "evolve.h"
+#include "pool.h"
+
+#include <float.h>
+
+// Breed the `k`th pair of children from the best two of four random
+// programs (or two lexicase-selected parents)
+static void _breed_pair(void * arg, uint k)
+{
+	GpWorld * world = arg;
+	const uint popsize = world->conf.population_size;
+	GpProgram * progs[4];
+
+	gp_rand_stream(_gp_rng, world->stats.total_steps, k, GP_STREAM_VARY);
+
+	if (world->_next.drawn != NULL) {
+		for (uint i = 0; i < 4; i++)
+			progs[i] = world->_next.drawn[k * 4 + i];
+		gp_tournament_sort(world, progs);
+	} else if (world->conf.selection == GP_SELECT_TOURNAMENT) {
+		for (uint i = 0; i < 4; i++)
+			progs[i] = world->programs + urand(0, popsize);
+		gp_tournament_sort(world, progs);
+	} else {
+		progs[0] = gp_select_lexicase(world);
+		progs[1] = gp_select_lexicase(world);
+	}
+
+	progs[2] = world->_next.programs + world->conf.num_elites + k * 2;
+	progs[3] = progs[2] + 1;
+	gp_world_vary(world, progs);
+
+	progs[2]->evaluated = progs[3]->evaluated = 0;
+	progs[2]->approximate = progs[3]->approximate = 0;
+}
+
+// Draw the programs of the `k`th tournament ahead of breeding, from a
+// stream of their own
+static void _draw_tournament(void * arg, uint k)
+{
+	GpWorld * world = arg;
+	const uint popsize = world->conf.population_size;
+
+	gp_rand_stream(_gp_rng, world->stats.total_steps, k, GP_STREAM_SELECT);
+	for (uint i = 0; i < 4; i++)
+		world->_next.drawn[k * 4 + i] = world->programs + urand(0, popsize);
+}
+
+//
+// Elites keep their ids, so their cached case errors stay where they are,
+// and the children take over the ids of the programs they replace.
+//
+static void _assign_ids(GpWorld * world)
+{
+	const uint popsize = world->conf.population_size;
+	const uint elites = world->conf.num_elites;
+	uint * ids = world->_next.ids;
+	uint i, n = 0;
+
+	for (i = 0; i < popsize; i++)
+		ids[i] = 0;
+	for (i = 0; i < elites; i++)
+		ids[world->programs[i].id] = 1;
+
+	// Compact the unmarked ids into the front of the same array
+	for (i = 0; i < popsize; i++)
+		if (ids[i] == 0)
+			ids[n++] = i;
+
+	for (i = 0; i < elites; i++)
+		world->_next.programs[i].id = world->programs[i].id;
+	for (i = 0; i < n; i++)
+		world->_next.programs[elites + i].id = ids[i];
+}
+
+// Breed every pair of children into the new population
+static void _breed_children(GpWorld * world, uint num_pairs)
+{
+	// Lexicase selection shares scratch space between calls, so only
+	// tournaments breed in parallel.
+	if (world->_pool != NULL && world->conf.selection == GP_SELECT_TOURNAMENT)
+		gp_pool_run(world->_pool, &_breed_pair, world, num_pairs);
+	else
+		for (uint i = 0; i < num_pairs; i++)
+			_breed_pair(world, i);
+}
+
+// `gp_world_evolve_generation` replaces the whole population with its
+// offspring, which counts as `population_size / 2` steps.
+void gp_world_evolve_generation(GpWorld * world)
+{
+	const uint popsize = world->conf.population_size;
+	const uint elites = world->conf.num_elites;
+	const uint num_children = popsize - elites;
+	const uint step = world->stats.total_steps;
+	GpProgram * next = world->_next.programs;
+	uint i;
+
+	// The last generation's children are scored only once drawn, so the
+	// children are bred before sorting moves the drawn programs around,
+	// and the elites are picked from every program scored by then.
+	if (world->_next.drawn != NULL)
+	{
+		if (world->_pool != NULL)
+			gp_pool_run(world->_pool, &_draw_tournament, world, num_children / 2);
+		else
+			for (i = 0; i < num_children / 2; i++)
+				_draw_tournament(world, i);
+
+		GpProgram ** unscored = new_array(GpProgram *, num_children * 2);
+		gp_world_evaluate_lazy(world, world->_next.drawn, num_children * 2, unscored);
+		delete(unscored);
+
+		_breed_children(world, num_children / 2);
+
+		const gp_fitness_t worst = world->conf.minimize_fitness ? FLT_MAX : -FLT_MAX;
+		for (i = 0; i < popsize; i++)
+			if (!world->programs[i].evaluated)
+				world->programs[i].fitness = worst;
+	}
+
+	// Best programs first, so the elites are the first `elites` of them
+	gp_world_sort_programs(world);
+	_assign_ids(world);
+
+	for (i = 0; i < elites; i++)
+		gp_program_copy(world->programs + i, next + i);
+
+	if (world->_next.drawn == NULL) {
+		_breed_children(world, num_children / 2);
+		for (i = 0; i < num_children; i++)
+			world->_next.children[i] = next + elites + i;
+		gp_world_evaluate(world, world->_next.children, num_children);
+	}
+
+	// Swap the two populations and their statement buffers
+	world->_next.programs = world->programs;
+	world->programs = next;
+	GpStatement * stmt_buf = world->_next.stmt_buf;
+	world->_next.stmt_buf = world->_stmt_buf;
+	world->_stmt_buf = stmt_buf;
+
+	if (world->_next.drawn != NULL)
+		for (i = 0; i < popsize; i++)
+			world->stats.lazy_avoided += !world->_next.programs[i].evaluated;
+
+	if (world->_id_slots != NULL)
+		for (i = 0; i < popsize; i++)
+			world->_id_slots[world->programs[i].id] = i;
+
+	world->stats.total_steps += popsize / 2;
+
+	if (world->conf.auto_optimize && world->stats.total_steps / 300000 != step / 300000)
+		gp_world_optimize(world);
+
+	if (world->_sample.cases != NULL
+		&& world->stats.total_steps / world->conf.sample_interval != step / world->conf.sample_interval)
+		gp_world_resample(world);
+}
@@ -0,0 +1,379 @@
+//
+// _link.c_ lets islands run as separate processes on one machine, each
+// with its own world, exchanging migrants through shared memory. Every
+// process opens the same named segment (`shm_open`) with the same config
+// and its own `island` index. No network is involved.
+//
+// The segment holds a ring buffer for every ordered pair of islands, so
+// each ring has exactly one writer and one reader, and neither ever takes
+// a lock. Migrants travel in a compact encoding (see `gp_program_encode`) and are
+// rescored on arrival. A sender never waits: a migrant that doesn't fit in
+// its ring is dropped. A receiver can wait for migrants on its doorbell, a
+// counter in the segment that senders bump, using a futex.
+//
+// As no lock is ever held, a process that dies leaves nothing locked
+// behind. A record only becomes visible once it is completely written, so
+// a sender dying mid-write loses just that record, and a restarted island
+// reopens the segment and carries on with whatever reached its rings in
+// the meantime. The segment outlives the processes until
+// `gp_link_unlink` removes it.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "gp.h"
+#include "mem.h"
+#include "evolve.h"
+#include "os.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+  #include <linux/futex.h>
+#endif
+
+#define GP_LINK_MIN_RING 4096
+
+// Where the doorbells start, after the header
+#define GP_LINK_BELLS 64
+
+typedef struct {
+	uint num_islands;
+	uint ring_bytes;
+} _Header;
+
+typedef struct {
+	uint head __attribute__((aligned(64)));
+	uint tail __attribute__((aligned(64)));
+	uint8_t data[] __attribute__((aligned(64)));
+} _Ring;
+
+static void _link_err(const char * estr)
+{
+	printf("libgp link ERROR: %s\n", estr);
+	abort();
+}
+
+static void _wake(uint * bell)
+{
+#ifdef __linux__
+	syscall(SYS_futex, bell, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+// Wait up to `secs` seconds for `bell` to move on from `value`
+static void _wait(uint * bell, uint value, double secs)
+{
+	struct timespec ts;
+#ifdef __linux__
+	ts.tv_sec = (time_t)secs;
+	ts.tv_nsec = (long)((secs - ts.tv_sec) * 1e9);
+	syscall(SYS_futex, bell, FUTEX_WAIT, value, &ts, NULL, 0);
+#else
+	(void)bell;
+	(void)value;
+	ts.tv_sec = 0;
+	ts.tv_nsec = (long)(gp_min(secs, 0.001) * 1e9);
+	nanosleep(&ts, NULL);
+#endif
+}
+
+//
+// ## Segment layout ##
+//
+// A header, one doorbell per island, then `num_islands * num_islands`
+// rings, the one from island `src` to island `dst` being at
+// `dst * num_islands + src`.
+//
+
+static size_t _rings_offset(uint n)
+{
+	return (GP_LINK_BELLS + n * sizeof(uint) + 63) & ~(size_t)63;
+}
+
+static size_t _ring_stride(uint ring_bytes)
+{
+	return sizeof(_Ring) + ring_bytes;
+}
+
+static inline uint * _bell(GpLink * link, uint island)
+{
+	return (uint *)((char *)link->_shm + GP_LINK_BELLS) + island;
+}
+
+static inline _Ring * _ring(GpLink * link, uint src, uint dst)
+{
+	const uint n = link->conf.num_islands;
+	return (_Ring *)((char *)link->_shm + _rings_offset(n)
+		+ (size_t)(dst * n + src) * _ring_stride(link->conf.ring_bytes));
+}
+
+// Copy bytes in or out of a ring at `pos`, wrapping around its end
+static void _ring_copy(GpLink * link, _Ring * ring, uint pos, void * bytes, uint count, int in)
+{
+	const uint size = link->conf.ring_bytes;
+	const uint start = pos & (size - 1);
+	const uint first = umin(count, size - start);
+
+	if (in) {
+		memcpy(ring->data + start, bytes, first);
+		memcpy(ring->data, (uint8_t *)bytes + first, count - first);
+	} else {
+		memcpy(bytes, ring->data + start, first);
+		memcpy((uint8_t *)bytes + first, ring->data, count - first);
+	}
+}
+
+// Append a record of `count` bytes, if there is room for it
+static int _ring_push(GpLink * link, _Ring * ring, void * bytes, uint count)
+{
+	const uint tail = ring->tail;
+	const uint head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (count + sizeof(uint) > link->conf.ring_bytes - (tail - head))
+		return 0;
+
+	_ring_copy(link, ring, tail, &count, sizeof(uint), 1);
+	_ring_copy(link, ring, tail + sizeof(uint), bytes, count, 1);
+	__atomic_store_n(&ring->tail, tail + sizeof(uint) + count, __ATOMIC_RELEASE);
+	return 1;
+}
+
+// Take the oldest record, if there is one, setting `count` to its size.
+// A record too big for `max` bytes is skipped, with a size of 0.
+static int _ring_pop(GpLink * link, _Ring * ring, void * bytes, uint max, uint * count)
+{
+	const uint head = ring->head;
+	const uint tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	uint size;
+
+	if (head == tail)
+		return 0;
+
+	_ring_copy(link, ring, head, &size, sizeof(uint), 0);
+	*count = size <= max ? size : 0;
+	_ring_copy(link, ring, head + sizeof(uint), bytes, *count, 0);
+
+	__atomic_store_n(&ring->head, head + sizeof(uint) + size, __ATOMIC_RELEASE);
+	return 1;
+}
+
+//
+// ## Links ##
+//
+
+// Returns a default config: four islands in a ring
+GpLinkConf gp_link_conf_default()
+{
+	return (GpLinkConf) {
+		.name = "/libgp-islands",
+		.num_islands = 4,
+		.island = 0,
+		.migration_interval = 10000,
+		.num_migrants = 4,
+		.topology = GP_TOPOLOGY_RING,
+		.torus_width = 0,
+		.ring_bytes = 65536
+	};
+}
+
+//
+// `gp_link_open` attaches this process to the shared segment `conf.name`
+// as island `conf.island`, creating the segment if no other island has
+// yet. Returns NULL if the segment can't be opened or mapped, or was
+// created with a different number of islands or ring size.
+//
+GpLink * gp_link_open(GpLinkConf conf)
+{
+	if (conf.name == NULL || conf.name[0] != '/')
+		_link_err("name must start with '/'");
+
+	if (conf.num_islands == 0 || conf.island >= conf.num_islands)
+		_link_err("island must be less than num_islands");
+
+	if (conf.migration_interval == 0)
+		_link_err("migration_interval must be at least 1");
+
+	if (conf.topology == GP_TOPOLOGY_TORUS && conf.torus_width > 0
+		&& conf.num_islands % conf.torus_width != 0)
+		_link_err("torus_width must divide num_islands");
+
+	if (conf.topology == GP_TOPOLOGY_TORUS)
+		conf.torus_width = gp_topology_width(conf.num_islands, conf.torus_width);
+
+	// Ring positions wrap with a mask
+	uint ring_bytes = GP_LINK_MIN_RING;
+	while (ring_bytes < conf.ring_bytes)
+		ring_bytes <<= 1;
+	conf.ring_bytes = ring_bytes;
+
+	const uint n = conf.num_islands;
+	const size_t size = _rings_offset(n) + (size_t)n * n * _ring_stride(ring_bytes);
+
+	const int fd = shm_open(conf.name, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		return NULL;
+
+	// A new segment is zero-filled, which is a valid set of empty rings
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (st.st_size != 0 && (size_t)st.st_size != size)
+		|| (st.st_size == 0 && ftruncate(fd, size) != 0))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void * shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+		return NULL;
+
+	// The first island to get here stamps the layout; the rest check it
+	_Header * header = shm;
+	uint expected = 0;
+	if (!__atomic_compare_exchange_n(&header->num_islands, &expected, n, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+		&& expected != n)
+	{
+		munmap(shm, size);
+		return NULL;
+	}
+	expected = 0;
+	if (!__atomic_compare_exchange_n(&header->ring_bytes, &expected, ring_bytes, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+		&& expected != ring_bytes)
+	{
+		munmap(shm, size);
+		return NULL;
+	}
+
+	GpLink * link = new(GpLink);
+	link->conf = conf;
+	link->stats.sent = 0;
+	link->stats.received = 0;
+	link->stats.dropped = 0;
+	link->stats.rejected = 0;
+	link->_shm = shm;
+	link->_size = size;
+	link->_turn = 0;
+	link->_next_migration = conf.migration_interval;
+
+	return link;
+}
+
+// Detach from the segment, leaving it for the other islands
+void gp_link_close(GpLink * link)
+{
+	munmap(link->_shm, link->_size);
+	delete(link);
+}
+
+// Remove the segment named `name`, once no island will open it again
+void gp_link_unlink(const char * name)
+{
+	shm_unlink(name);
+}
+
+//
+// `gp_link_migrate` sends copies of the world's best `num_migrants`
+// programs to the next island in the topology, then takes in up to
+// `num_migrants` programs that other islands have sent, in place of its
+// worst ones. If none have arrived, it waits up to `wait_secs` seconds for
+// some. Returns the number taken in.
+//
+uint gp_link_migrate(GpLink * link, GpWorld * world, float wait_secs)
+{
+	const uint n = link->conf.num_islands;
+	const uint self = link->conf.island;
+	const uint k = umin(link->conf.num_migrants, world->conf.population_size / 2);
+	const uint popsize = world->conf.population_size;
+	uint i;
+
+	if (world->conf.num_ops > GP_ENCODE_MAX_OPS || world->conf.num_inputs > GP_ENCODE_MAX_INPUTS)
+		_link_err("migrants can only be encoded with at most 256 ops and 65536 inputs");
+
+	// Best programs first, as a fully scored population
+	gp_world_process_stats(world);
+
+	const uint max_bytes = 2 + world->conf.max_program_length * GP_STMT_BYTES;
+	uint8_t * bytes = new_array(uint8_t, max_bytes);
+
+	if (n > 1)
+	{
+		const uint dst = gp_topology_neighbour(link->conf.topology, n, link->conf.torus_width, self, link->_turn++);
+		_Ring * ring = _ring(link, self, dst);
+
+		for (i = 0; i < k; i++) {
+			const uint count = gp_program_encode(world, world->programs + i, bytes);
+			if (_ring_push(link, ring, bytes, count))
+				link->stats.sent++;
+			else
+				link->stats.dropped++;
+		}
+
+		__atomic_fetch_add(_bell(link, dst), 1, __ATOMIC_RELEASE);
+		_wake(_bell(link, dst));
+	}
+
+	GpProgram migrant;
+	migrant.stmts = new_array(GpStatement, world->conf.max_program_length);
+	GpProgram ** arrivals = new_array(GpProgram *, k);
+	const double deadline = gp_now() + wait_secs;
+	uint received = 0;
+
+	for (;;)
+	{
+		const uint bell = __atomic_load_n(_bell(link, self), __ATOMIC_ACQUIRE);
+
+		for (uint src = 0; src < n && received < k; src++) {
+			_Ring * ring = _ring(link, src, self);
+			uint count;
+			while (received < k && _ring_pop(link, ring, bytes, max_bytes, &count)) {
+				if (!gp_program_decode(world, bytes, count, &migrant)) {
+					link->stats.rejected++;
+					continue;
+				}
+				arrivals[received] = world->programs + popsize - 1 - received;
+				gp_program_copy(&migrant, arrivals[received]);
+				received++;
+			}
+		}
+
+		const double remaining = deadline - gp_now();
+		if (received > 0 || remaining <= 0)
+			break;
+		_wait(_bell(link, self), bell, remaining);
+	}
+
+	gp_world_evaluate(world, arrivals, received);
+	link->stats.received += received;
+
+	delete(arrivals);
+	delete(migrant.stmts);
+	delete(bytes);
+	return received;
+}
+
+//
+// `gp_link_evolve_times` evolves the world `times` steps, migrating every
+// `migration_interval` steps without waiting for arrivals.
+//
+void gp_link_evolve_times(GpLink * link, GpWorld * world, uint times)
+{
+	const uint target = world->stats.total_steps + times;
+
+	while (world->stats.total_steps < target)
+	{
+		const uint steps = world->stats.total_steps;
+		if (steps >= link->_next_migration) {
+			gp_link_migrate(link, world, 0);
+			while (link->_next_migration <= steps)
+				link->_next_migration += link->conf.migration_interval;
+		}
+
+		gp_world_evolve_times(world, umin(link->_next_migration - steps, target - steps));
+	}
+}
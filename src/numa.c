@@ -0,0 +1,211 @@
+//
+// _numa.c_ spreads a world over the NUMA nodes of the machine when `numa`
+// is set. The population's ids are split into one contiguous range per
+// node, and the statement blocks of a node's ids are put in that node's
+// memory: first touched by a thread running there (`GP_NUMA_FIRST_TOUCH`),
+// or bound to it with `mbind` (`GP_NUMA_BIND`). Worker threads are pinned
+// to the nodes in turn and draw their tournaments mostly from their own
+// node's ids (see _parallel.c_). Every thread reads the whole dataset, so
+// its rows are interleaved over all nodes rather than split between them.
+//
+// Nodes are found through _/sys/devices/system/node_ and memory policy is
+// set with raw system calls, so libnuma isn't needed. Elsewhere than Linux
+// the machine counts as a single node, and pinning and binding do nothing.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "gp.h"
+#include "mem.h"
+#include "numa.h"
+#include "os.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+  #include <linux/mempolicy.h>
+#endif
+
+// The most nodes and CPUs a mask can name
+#define GP_NUMA_MAX_NODES 64
+#define GP_NUMA_MAX_CPUS 1024
+
+#define GP_MASK_BITS (8 * sizeof(unsigned long))
+
+typedef struct {
+	char * first;
+	size_t size;
+	uint node;
+	pthread_t thread;
+} _Touch;
+
+static uint _num_nodes = 0;
+
+// Read a kernel list of CPUs or nodes, such as "0-3,8-11", into `mask`.
+// Returns one more than the highest entry, or 0 if there are none.
+static uint _read_list(const char * path, unsigned long * mask, uint max_bits)
+{
+	FILE * file = fopen(path, "r");
+	uint first, last, top = 0;
+
+	if (file == NULL)
+		return 0;
+
+	while (fscanf(file, "%u", &first) == 1)
+	{
+		int c = fgetc(file);
+		last = first;
+		if (c == '-') {
+			if (fscanf(file, "%u", &last) != 1)
+				break;
+			c = fgetc(file);
+		}
+
+		for (uint i = first; i <= last && i < max_bits; i++)
+			mask[i / GP_MASK_BITS] |= 1ul << (i % GP_MASK_BITS);
+		top = gp_max(top, umin(last + 1, max_bits));
+
+		if (c != ',')
+			break;
+	}
+
+	fclose(file);
+	return top;
+}
+
+static size_t _page_size(void)
+{
+	const long size = sysconf(_SC_PAGESIZE);
+	return size > 0 ? (size_t)size : 4096;
+}
+
+// `gp_numa_num_nodes` counts the machine's NUMA nodes, up to the highest
+// one online.
+uint gp_numa_num_nodes()
+{
+	uint n = __atomic_load_n(&_num_nodes, __ATOMIC_RELAXED);
+	if (n == 0) {
+		unsigned long mask[GP_NUMA_MAX_NODES / GP_MASK_BITS] = { 0 };
+		n = gp_max(_read_list("/sys/devices/system/node/online", mask, GP_NUMA_MAX_NODES), 1);
+		__atomic_store_n(&_num_nodes, n, __ATOMIC_RELAXED);
+	}
+	return n;
+}
+
+// `gp_numa_node_of` returns the node holding the page at `addr`, faulting
+// it in if it isn't yet, or -1 if that can't be found out.
+int gp_numa_node_of(const void * addr)
+{
+#ifdef __linux__
+	int node = -1;
+	if (syscall(SYS_get_mempolicy, &node, NULL, 0ul, addr, (unsigned long)(MPOL_F_NODE | MPOL_F_ADDR)) != 0)
+		return -1;
+	return node;
+#else
+	return 0;
+#endif
+}
+
+// Keep the calling thread on the CPUs of `node`. Returns 1 on success.
+int gp_numa_pin(uint node)
+{
+#ifdef __linux__
+	unsigned long mask[GP_NUMA_MAX_CPUS / GP_MASK_BITS] = { 0 };
+	char path[64];
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+	if (_read_list(path, mask, GP_NUMA_MAX_CPUS) == 0)
+		return 0;
+	return syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) == 0;
+#else
+	return 0;
+#endif
+}
+
+// Allocate whole pages, so they can be placed separately from the rest of
+// the heap. The memory is released with `delete`.
+void * gp_numa_alloc(size_t size)
+{
+	const size_t page = _page_size();
+	void * ptr;
+
+	if (posix_memalign(&ptr, page, (size + page - 1) / page * page) != 0)
+		return NULL;
+	return ptr;
+}
+
+#ifdef __linux__
+// Apply `mode` to the whole pages in [`first`, `end`) for the nodes in
+// `nodes`, moving any pages already touched
+static void _mbind(char * first, char * end, int mode, unsigned long nodes)
+{
+	const uintptr_t page = _page_size();
+	const uintptr_t start = ((uintptr_t)first + page - 1) & ~(page - 1);
+	const uintptr_t stop = (uintptr_t)end & ~(page - 1);
+
+	if (stop > start)
+		syscall(SYS_mbind, (void *)start, (unsigned long)(stop - start), (unsigned long)mode,
+			&nodes, (unsigned long)GP_MASK_BITS + 1, (unsigned long)MPOL_MF_MOVE);
+}
+#endif
+
+static void * _touch_main(void * arg)
+{
+	_Touch * touch = arg;
+	gp_numa_pin(touch->node);
+	memset(touch->first, 0, touch->size);
+	return NULL;
+}
+
+//
+// `gp_numa_place` puts `buf`, which holds a block of `block_size` bytes
+// for each program id, on the nodes owning those ids. `buf` must come from
+// `gp_numa_alloc`, and for first touch must not have been written to yet.
+// Pages shared by two nodes' blocks go to the first.
+//
+void gp_numa_place(GpWorld * world, void * buf, size_t block_size)
+{
+	const uint nodes = world->_numa_nodes;
+	const size_t page = _page_size();
+	char * base = buf;
+	uint k;
+
+	if (world->conf.numa == GP_NUMA_BIND)
+	{
+#ifdef __linux__
+		const size_t total = world->conf.population_size * block_size;
+		for (k = 0; k < nodes; k++) {
+			// Align down, so the pages run on without gaps
+			const size_t first = k == 0 ? 0 : gp_numa_first_id(world, k) * block_size / page * page;
+			const size_t end = k + 1 == nodes ? (total + page - 1) / page * page
+				: gp_numa_first_id(world, k + 1) * block_size / page * page;
+			_mbind(base + first, base + end, MPOL_BIND, 1ul << (k % GP_MASK_BITS));
+		}
+#endif
+		return;
+	}
+
+	_Touch * touches = new_array(_Touch, nodes);
+	for (k = 0; k < nodes; k++) {
+		const size_t first = gp_numa_first_id(world, k) * block_size;
+		touches[k].first = base + first;
+		touches[k].size = gp_numa_first_id(world, k + 1) * block_size - first;
+		touches[k].node = k;
+		pthread_create(&touches[k].thread, NULL, &_touch_main, touches + k);
+	}
+	for (k = 0; k < nodes; k++)
+		pthread_join(touches[k].thread, NULL);
+	delete(touches);
+}
+
+// Spread the pages of `buf` round-robin over all nodes
+void gp_numa_interleave(void * buf, size_t size)
+{
+#ifdef __linux__
+	const uint nodes = umin(gp_numa_num_nodes(), GP_MASK_BITS);
+	const unsigned long all = nodes == GP_MASK_BITS ? ~0ul : (1ul << nodes) - 1;
+	_mbind(buf, (char *)buf + size, MPOL_INTERLEAVE, all);
+#endif
+}
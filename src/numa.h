@@ -0,0 +1,23 @@
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+//
+// Thread pinning and memory placement on NUMA nodes (see _numa.c_). Not
+// part of the public interface.
+//
+
+#include "gp.h"
+
+int    gp_numa_pin        (uint);
+void * gp_numa_alloc      (size_t);
+void   gp_numa_place      (GpWorld *, void *, size_t);
+void   gp_numa_interleave (void *, size_t);
+
+// The first id of the range owned by `node`; `node == _numa_nodes` gives
+// the end of the last range
+static inline uint gp_numa_first_id(GpWorld * world, uint node)
+{
+	return (uint)((ulong)node * world->conf.population_size / world->_numa_nodes);
+}
+
+#endif
@@ -6,6 +6,8 @@
 //
 
 #include "gp.h"
+#include "evolve.h"
+#include "pool.h"
 
 #include <string.h>
 
@@ -29,6 +31,7 @@ static uint _remove_introns(GpWorld * world, GpProgram * program)
 		{
 			marked[i] = 1;
 			used_vars[out] = 0;
+			// Constants and input bank reads never depend on earlier statements
 			for (uint j = 0; j < stmt->op->num_args; j++)
 				if (stmt->args[j].type == GP_ARG_REGISTER)
 					used_vars[stmt->args[j].data.reg] = 1;
@@ -49,16 +52,26 @@ static uint _remove_introns(GpWorld * world, GpProgram * program)
 	return num_introns;
 }
 
+static void _optimize_task(void * arg, uint i)
+{
+	GpWorld * world = arg;
+	_remove_introns(world, world->programs + i);
+}
+
 //
 // `gp_world_optimize` will run various optimizations functions on every
-// program in `world`.
+// program in `world`, spread over the world's thread pool if it has one.
 //
 void gp_world_optimize(GpWorld * world)
 {
-	uint introns_removed = 0;
-	for (uint i = 0; i < world->conf.population_size; i++)
-		introns_removed += _remove_introns(world, &world->programs[i]);
-
+	// Programs still being scored in the background mustn't change
+	gp_background_finish(world);
+
+	if (world->_pool != NULL)
+		gp_pool_run(world->_pool, &_optimize_task, world, world->conf.population_size);
+	else
+		for (uint i = 0; i < world->conf.population_size; i++)
+			_remove_introns(world, world->programs + i);
 }
 
 //
@@ -0,0 +1,28 @@
+#ifndef __OS_H__
+#define __OS_H__
+
+//
+// Operating system pieces shared by the modules that run threads,
+// processes and sockets. Its users define `_POSIX_C_SOURCE` before any
+// include. Not part of the public interface.
+//
+
+#include <time.h>
+
+#ifdef __linux__
+  #include <sys/syscall.h>
+
+  // _unistd.h_ only declares this with `_DEFAULT_SOURCE`, whose `ulong`
+  // clashes with ours
+  extern long syscall(long, ...);
+#endif
+
+// Seconds on the monotonic clock
+static inline double gp_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#endif
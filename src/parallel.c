@@ -0,0 +1,440 @@
+//
+// _parallel.c_ runs the steady-state algorithm on several threads at once.
+// Each worker draws its own tournaments with its own random generator.
+// Before a tournament runs, the worker claims all four of its programs with
+// an atomic exchange on `GpProgram._busy`. If another worker already holds
+// any of them, the claims are dropped and new programs are drawn, so no two
+// threads ever read or write the same program at the same time.
+//
+// With `rand_mode` set to `GP_RAND_COUNTER`, runs are instead planned so
+// that they give exactly the same population as the serial loop, whatever
+// the number of threads. Each step's programs are drawn up front from the
+// step's own random stream, and the steps of a batch are grouped into
+// rounds: a step goes in the round after the last earlier step that
+// touched any of its programs. Steps in one round touch disjoint programs
+// and run in parallel, and rounds run one after another, so every program
+// sees the same steps in the same order as it would serially.
+//
+// In a world spread over NUMA nodes, worker `i` is pinned to node `i` of
+// them in turn. Without a plan, it draws its programs from the ids owned
+// by its node, whose statements are in its node's memory, and from the
+// whole population only with probability `numa_exchange`, so that good
+// programs still spread between nodes. Planned runs keep their draws.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "gp.h"
+#include "mem.h"
+#include "evolve.h"
+#include "pool.h"
+#include "numa.h"
+#include "os.h"
+
+#include <pthread.h>
+
+// Steps a worker claims from the shared budget at a time, and how often it
+// checks the clock when running for a fixed time.
+#define GP_STEP_BLOCK 64
+
+// Steps planned together in counter mode
+#define GP_PLAN_STEPS 4096
+
+// Auto-optimize interval; planned batches stop at its multiples, which is
+// where the serial loop optimizes.
+#define GP_OPTIMIZE_STEPS 300000
+
+typedef struct {
+	uint first_step;
+	uint num_steps;
+	uint * slots;
+	uint * round;
+	uint * order;
+	uint * round_end;
+	uint * next;
+	uint num_rounds;
+	uint * ready;
+	int done;
+	pthread_barrier_t barrier;
+} _Plan;
+
+// A run lasts `remaining` steps, which workers take from concurrently, or
+// if `timed` is set, until `deadline`
+typedef struct {
+	GpWorld * world;
+	int timed;
+	long remaining;
+	double deadline;
+	_Plan * plan;
+} _Run;
+
+typedef struct {
+	_Run * run;
+	uint32_t seed;
+	GpCounters counters;
+	uint node;
+	uint local;
+	uint remote;
+	pthread_t thread;
+} __attribute__((aligned(64))) _Worker;
+
+static inline int _claim(GpProgram * program)
+{
+	return __atomic_exchange_n(&program->_busy, 1, __ATOMIC_ACQUIRE) == 0;
+}
+
+static inline void _release(GpProgram * program)
+{
+	__atomic_store_n(&program->_busy, 0, __ATOMIC_RELEASE);
+}
+
+// Draw a program for `worker`, from its own node's ids unless exchanging
+static inline GpProgram * _draw(GpWorld * world, _Worker * worker)
+{
+	if (world->conf.numa == GP_NUMA_OFF)
+		return world->programs + urand(0, world->conf.population_size);
+
+	const uint first = gp_numa_first_id(world, worker->node);
+	const uint end = gp_numa_first_id(world, worker->node + 1);
+	uint id;
+
+	if (rand_float() < world->conf.numa_exchange)
+		id = urand(0, world->conf.population_size);
+	else
+		id = urand(first, end);
+
+	if (id >= first && id < end)
+		worker->local++;
+	else
+		worker->remote++;
+	return world->programs + world->_id_slots[id];
+}
+
+// Draw four programs and claim them, retrying until none of them are held
+// by another worker. The same program may be drawn more than once, as in
+// the serial loop; it is only claimed once. Returns how many were claimed.
+static uint _claim_tournament(GpWorld * world, _Worker * worker, GpProgram ** progs, GpProgram ** claimed)
+{
+	for (;;)
+	{
+		uint i, j, n = 0;
+
+		for (i = 0; i < 4; i++)
+		{
+			GpProgram * program = _draw(world, worker);
+			for (j = 0; j < n && claimed[j] != program; j++)
+				;
+			if (j == n) {
+				if (!_claim(program))
+					break;
+				claimed[n++] = program;
+			}
+			progs[i] = program;
+		}
+
+		if (i == 4)
+			return n;
+
+		while (n > 0)
+			_release(claimed[--n]);
+	}
+}
+
+//
+// Draw the programs for the next `count` steps, starting at `first`, and
+// group the steps into rounds. Serial tournaments draw their programs from
+// the same streams.
+//
+static void _plan_batch(GpWorld * world, _Plan * plan, uint first, uint count)
+{
+	const uint popsize = world->conf.population_size;
+	GpRand * rng = &world->_rand;
+	uint i, j, r;
+
+	plan->first_step = first;
+	plan->num_steps = count;
+	plan->num_rounds = 0;
+
+	for (i = 0; i < popsize; i++)
+		plan->ready[i] = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		uint * slots = plan->slots + i * 4;
+
+		gp_rand_stream(rng, first + i, 0, GP_STREAM_SELECT);
+		r = 0;
+		for (j = 0; j < 4; j++) {
+			slots[j] = gp_rand_range(rng, 0, popsize);
+			r = gp_max(r, plan->ready[slots[j]]);
+		}
+		for (j = 0; j < 4; j++)
+			plan->ready[slots[j]] = r + 1;
+
+		plan->round[i] = r;
+		plan->num_rounds = gp_max(plan->num_rounds, r + 1);
+	}
+
+	// Counting sort of the steps by round, keeping step order within one
+	for (r = 0; r < plan->num_rounds; r++)
+		plan->round_end[r] = 0;
+	for (i = 0; i < count; i++)
+		plan->round_end[plan->round[i]]++;
+	for (r = 1; r < plan->num_rounds; r++)
+		plan->round_end[r] += plan->round_end[r - 1];
+	for (i = count; i-- > 0; )
+		plan->order[--plan->round_end[plan->round[i]]] = i;
+
+	// `round_end` now holds where each round starts
+	for (r = 0; r < plan->num_rounds; r++) {
+		plan->next[r] = plan->round_end[r];
+		plan->round_end[r] = r + 1 < plan->num_rounds ? plan->round_end[r + 1] : count;
+	}
+}
+
+static void _run_planned(_Worker * worker)
+{
+	_Plan * plan = worker->run->plan;
+	GpWorld * world = worker->run->world;
+
+	for (;;)
+	{
+		pthread_barrier_wait(&plan->barrier);
+		if (plan->done)
+			break;
+
+		// The scheduler replans as soon as the last round ends, so the
+		// round count has to be read before then.
+		const uint num_rounds = plan->num_rounds;
+		for (uint r = 0; r < num_rounds; r++)
+		{
+			for (;;)
+			{
+				const uint k = __atomic_fetch_add(&plan->next[r], 1, __ATOMIC_RELAXED);
+				if (k >= plan->round_end[r])
+					break;
+
+				const uint i = plan->order[k];
+				const uint * slots = plan->slots + i * 4;
+				GpProgram * progs[] = {
+					world->programs + slots[0],
+					world->programs + slots[1],
+					world->programs + slots[2],
+					world->programs + slots[3]
+				};
+
+				gp_rand_stream(_gp_rng, plan->first_step + i, 0, GP_STREAM_VARY);
+				gp_world_tournament(world, progs, &worker->counters);
+			}
+			pthread_barrier_wait(&plan->barrier);
+		}
+	}
+}
+
+static void * _worker_main(void * arg)
+{
+	_Worker * worker = arg;
+	_Run * run = worker->run;
+	GpWorld * world = run->world;
+
+	// This thread's own generator, for everything it does through `urand`.
+	// In counter mode it shares the world's key, so streams match.
+	GpRand rng;
+	gp_rand_seed(&rng, worker->seed, world->conf.rand_mode);
+	_gp_rng = &rng;
+
+	if (world->conf.numa != GP_NUMA_OFF)
+		gp_numa_pin(worker->node);
+
+	if (run->plan != NULL) {
+		_run_planned(worker);
+		return NULL;
+	}
+
+	for (;;)
+	{
+		long block = GP_STEP_BLOCK;
+
+		if (!run->timed) {
+			const long left = __atomic_fetch_sub(&run->remaining, GP_STEP_BLOCK, __ATOMIC_RELAXED);
+			if (left <= 0)
+				break;
+			block = gp_min(left, GP_STEP_BLOCK);
+		} else if (gp_now() >= run->deadline) {
+			break;
+		}
+
+		while (block--)
+		{
+			GpProgram * progs[4];
+			GpProgram * claimed[4];
+			uint n = _claim_tournament(world, worker, progs, claimed);
+
+			gp_world_tournament(world, progs, &worker->counters);
+
+			while (n > 0)
+				_release(claimed[--n]);
+		}
+	}
+
+	return NULL;
+}
+
+// Features that keep shared state per step (deferred offspring, case
+// sampling, lexicase and batch scratch space) only run on the serial loop,
+// and generational worlds parallelize on their own.
+static int _can_run_parallel(GpWorld * world)
+{
+	return world->conf.algorithm == GP_STEADY_STATE
+		&& world->_pending == NULL
+		&& world->_sample.cases == NULL
+		&& world->_batch.size == 1
+		&& world->conf.selection == GP_SELECT_TOURNAMENT;
+}
+
+// Plan batches and release the workers on them, one round at a time,
+// until `run` is used up
+static void _schedule_planned(GpWorld * world, _Run * run)
+{
+	_Plan * plan = run->plan;
+	uint step = world->stats.total_steps;
+
+	for (;;)
+	{
+		uint count = GP_PLAN_STEPS;
+		if (!run->timed) {
+			const long left = __atomic_load_n(&run->remaining, __ATOMIC_RELAXED);
+			if (left <= 0)
+				break;
+			count = gp_min((ulong)count, (ulong)left);
+		} else if (gp_now() >= run->deadline) {
+			break;
+		}
+		if (world->conf.auto_optimize)
+			count = gp_min(count, GP_OPTIMIZE_STEPS - step % GP_OPTIMIZE_STEPS);
+
+		_plan_batch(world, plan, step, count);
+
+		pthread_barrier_wait(&plan->barrier);
+		for (uint r = 0; r < plan->num_rounds; r++)
+			pthread_barrier_wait(&plan->barrier);
+
+		step += count;
+		if (!run->timed)
+			__atomic_fetch_sub(&run->remaining, count, __ATOMIC_RELAXED);
+		if (world->conf.auto_optimize && step % GP_OPTIMIZE_STEPS == 0)
+			gp_world_optimize(world);
+	}
+
+	plan->done = 1;
+	pthread_barrier_wait(&plan->barrier);
+}
+
+// Run the workers until `run` is used up, then merge their counters
+static void _run_workers(GpWorld * world, _Run * run)
+{
+	// Workers draw from the whole population, so all of it must be scored
+	gp_background_finish(world);
+
+	const uint num_threads = gp_pool_size(world->conf.num_threads);
+	const uint steps_before = world->stats.total_steps;
+	_Worker * workers = new_array(_Worker, num_threads);
+	_Plan plan;
+	uint i;
+
+	if (world->conf.rand_mode == GP_RAND_COUNTER)
+	{
+		const uint popsize = world->conf.population_size;
+		plan.slots = new_array(uint, GP_PLAN_STEPS * 4);
+		plan.round = new_array(uint, GP_PLAN_STEPS);
+		plan.order = new_array(uint, GP_PLAN_STEPS);
+		plan.round_end = new_array(uint, GP_PLAN_STEPS);
+		plan.next = new_array(uint, GP_PLAN_STEPS);
+		plan.ready = new_array(uint, popsize);
+		plan.done = 0;
+		pthread_barrier_init(&plan.barrier, NULL, num_threads + 1);
+		run->plan = &plan;
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		workers[i].run = run;
+		workers[i].seed = world->conf.rand_mode == GP_RAND_COUNTER ?
+			world->_rand.key : gp_rand_next(&world->_rand);
+		workers[i].counters.steps = 0;
+		workers[i].counters.screened = 0;
+		workers[i].node = i % world->_numa_nodes;
+		workers[i].local = workers[i].remote = 0;
+		pthread_create(&workers[i].thread, NULL, &_worker_main, workers + i);
+	}
+
+	if (run->plan != NULL)
+		_schedule_planned(world, run);
+
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		world->stats.total_steps += workers[i].counters.steps;
+		world->stats.total_screened += workers[i].counters.screened;
+		world->stats.numa_local += workers[i].local;
+		world->stats.numa_remote += workers[i].remote;
+	}
+
+	delete(workers);
+
+	if (run->plan != NULL) {
+		pthread_barrier_destroy(&plan.barrier);
+		delete(plan.slots);
+		delete(plan.round);
+		delete(plan.order);
+		delete(plan.round_end);
+		delete(plan.next);
+		delete(plan.ready);
+	}
+
+	// Intron removal touches every program, so without a plan it waits
+	// until the workers are done rather than running every 300000 steps.
+	else if (world->conf.auto_optimize
+		&& world->stats.total_steps / GP_OPTIMIZE_STEPS != steps_before / GP_OPTIMIZE_STEPS)
+		gp_world_optimize(world);
+
+	gp_world_process_stats(world);
+}
+
+//
+// `gp_world_evolve_times_parallel` evolves `times` steps spread over
+// `conf.num_threads` threads (or one per online CPU, if 0). The evaluator
+// must be safe to call from several threads at once. In counter mode the
+// result matches `gp_world_evolve_times` exactly. Worlds using deferred
+// evaluation, case sampling, lexicase selection or batched tournaments run
+// serially instead, as does the generational algorithm, which uses its own
+// thread pool.
+//
+void gp_world_evolve_times_parallel(GpWorld * world, uint times)
+{
+	if (!_can_run_parallel(world)) {
+		gp_world_evolve_times(world, times);
+		return;
+	}
+
+	_Run run = { world, 0, (long)times, 0, NULL };
+	_run_workers(world, &run);
+}
+
+// Evolve on several threads until `gens` generations have passed
+void gp_world_evolve_gens_parallel(GpWorld * world, uint gens)
+{
+	gp_world_evolve_times_parallel(world, gens * world->conf.population_size / 2);
+}
+
+// Evolve on several threads for `nsecs` seconds of wall clock time.
+// Returns the number of steps taken.
+uint gp_world_evolve_secs_parallel(GpWorld * world, float nsecs)
+{
+	if (!_can_run_parallel(world))
+		return gp_world_evolve_secs(world, nsecs);
+
+	const uint steps_before = world->stats.total_steps;
+	_Run run = { world, 1, 0, gp_now() + nsecs, NULL };
+	_run_workers(world, &run);
+
+	return world->stats.total_steps - steps_before;
+}
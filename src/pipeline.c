@@ -0,0 +1,470 @@
+//
+// _pipeline.c_ runs the steady-state algorithm as a pipeline, used when
+// `algorithm` is `GP_PIPELINED`. The calling thread breeds offspring
+// (selection and variation) into spare programs and queues them, a set of
+// evaluator threads score them, and the calling thread commits scored
+// offspring back into the population in place of the tournament losers.
+// Breeding thus carries on while offspring are being scored.
+//
+// Only the calling thread ever touches the population. A tournament's
+// losers are reserved (through `GpProgram._busy`) until its offspring are
+// committed, so no other tournament draws them in the meantime. Offspring
+// are committed by swapping statement buffers with their losers, so
+// nothing is copied until the run ends and the buffers are handed back.
+//
+// The number of tournaments in flight is bounded by `pipeline_depth`. When
+// all of them are in flight the breeder sleeps until an evaluator is done,
+// and each such wait is counted in `stats.pipeline_stalls`. An evaluator
+// that finds nothing to do sleeps until there is, and each such wait is
+// counted in `stats.pipeline_starved`.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "gp.h"
+#include "mem.h"
+#include "evolve.h"
+#include "evaluate.h"
+#include "pool.h"
+#include "os.h"
+
+#include <pthread.h>
+#include <string.h>
+
+//
+// A bounded lock-free queue of uints, safe for any number of producers and
+// consumers (Vyukov's design). Each cell's sequence number says whether it
+// is ready to be written (== position) or read (== position + 1).
+//
+typedef struct {
+	uint seq;
+	uint value;
+} _Cell;
+
+typedef struct {
+	_Cell * cells;
+	uint mask;
+	uint head __attribute__((aligned(64)));
+	uint tail __attribute__((aligned(64)));
+} _Queue;
+
+static void _queue_init(_Queue * q, uint capacity)
+{
+	uint size = 1;
+	while (size < capacity)
+		size <<= 1;
+
+	q->cells = new_array(_Cell, size);
+	q->mask = size - 1;
+	q->head = q->tail = 0;
+	for (uint i = 0; i < size; i++)
+		q->cells[i].seq = i;
+}
+
+static int _queue_push(_Queue * q, uint value)
+{
+	uint pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	_Cell * cell;
+
+	for (;;) {
+		cell = q->cells + (pos & q->mask);
+		const int diff = (int)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->value = value;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static int _queue_pop(_Queue * q, uint * value)
+{
+	uint pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	_Cell * cell;
+
+	for (;;) {
+		cell = q->cells + (pos & q->mask);
+		const int diff = (int)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	*value = cell->value;
+	__atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static inline uint _queue_depth(_Queue * q)
+{
+	return __atomic_load_n(&q->tail, __ATOMIC_RELAXED) - __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+}
+
+// One tournament in flight: its offspring and the losers they replace
+typedef struct {
+	GpProgram children[2];
+	GpProgram * losers[2];
+	gp_fitness_t threshold;
+	uint screened;
+} _Pair;
+
+//
+// The queues never block, so a thread that finds its queue empty sleeps
+// on a condition variable instead. It counts itself in `sleepers` before
+// looking again, and the other side checks `sleepers` after pushing, so
+// one of them always sees the other.
+//
+typedef struct {
+	GpWorld * world;
+	_Pair * pairs;
+	_Queue scored_queue;
+	_Queue work_queue;
+	int stop;
+	uint starved;
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_cond_t scored;
+	uint sleepers;
+	int breeder_sleeps;
+} _Pipeline;
+
+// Wake the evaluators after queueing work (or asking them to stop)
+static void _wake_evaluators(_Pipeline * pipe, int all)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pipe->sleepers, __ATOMIC_RELAXED) == 0)
+		return;
+
+	pthread_mutex_lock(&pipe->lock);
+	if (all)
+		pthread_cond_broadcast(&pipe->work_ready);
+	else
+		pthread_cond_signal(&pipe->work_ready);
+	pthread_mutex_unlock(&pipe->lock);
+}
+
+// Wake the breeder after queueing scored offspring
+static void _wake_breeder(_Pipeline * pipe)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&pipe->breeder_sleeps, __ATOMIC_RELAXED))
+		return;
+
+	pthread_mutex_lock(&pipe->lock);
+	pthread_cond_signal(&pipe->scored);
+	pthread_mutex_unlock(&pipe->lock);
+}
+
+// Take the next pair to score, sleeping while there is none. Returns 0
+// once the pipeline stops.
+static int _next_work(_Pipeline * pipe, uint * p, uint * starved)
+{
+	if (_queue_pop(&pipe->work_queue, p))
+		return 1;
+
+	pthread_mutex_lock(&pipe->lock);
+	__atomic_fetch_add(&pipe->sleepers, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	(*starved)++;
+
+	int found;
+	while (!(found = _queue_pop(&pipe->work_queue, p)) && !__atomic_load_n(&pipe->stop, __ATOMIC_ACQUIRE))
+		pthread_cond_wait(&pipe->work_ready, &pipe->lock);
+
+	__atomic_fetch_sub(&pipe->sleepers, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&pipe->lock);
+	return found;
+}
+
+// Sleep until an evaluator queues scored offspring
+static void _await_scored(_Pipeline * pipe)
+{
+	pthread_mutex_lock(&pipe->lock);
+	__atomic_store_n(&pipe->breeder_sleeps, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	while (_queue_depth(&pipe->scored_queue) == 0)
+		pthread_cond_wait(&pipe->scored, &pipe->lock);
+	__atomic_store_n(&pipe->breeder_sleeps, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&pipe->lock);
+}
+
+typedef struct {
+	_Pipeline * pipe;
+	uint32_t seed;
+	pthread_t thread;
+} _Evaluator;
+
+static void * _evaluator_main(void * arg)
+{
+	_Evaluator * evaluator = arg;
+	_Pipeline * pipe = evaluator->pipe;
+	GpWorld * world = pipe->world;
+	uint starved = 0;
+	uint p;
+
+	GpRand rng;
+	gp_rand_seed(&rng, evaluator->seed, GP_RAND_SFMT);
+	_gp_rng = &rng;
+
+	while (_next_work(pipe, &p, &starved))
+	{
+		_Pair * pair = pipe->pairs + p;
+		pair->screened = 0;
+		for (uint i = 0; i < 2; i++) {
+			GpProgram * child = pair->children + i;
+			if (world->_screen_rows != NULL)
+				pair->screened += gp_screen_evaluate(world, &child, &pair->threshold, 1);
+			else if (world->_surrogate != NULL)
+				pair->screened += gp_surrogate_evaluate(world, &child, &pair->threshold, 1);
+			else {
+				child->fitness = world->conf.evaluator(world, child);
+				child->evaluated = 1;
+				child->approximate = 0;
+			}
+		}
+
+		// There is always room: no more pairs exist than the queue holds
+		_queue_push(&pipe->scored_queue, p);
+		_wake_breeder(pipe);
+	}
+
+	__atomic_fetch_add(&pipe->starved, starved, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+// Draw a program for a tournament, skipping reserved losers
+static inline GpProgram * _free_program(GpWorld * world)
+{
+	GpProgram * program;
+	do
+		program = world->programs + urand(0, world->conf.population_size);
+	while (program->_busy);
+	return program;
+}
+
+//
+// Run a tournament and breed its offspring into `pair`. Returns 0 if the
+// tournament bred nothing (both losers were the same program, or one was
+// also a parent), in which case the step is already complete.
+//
+static int _breed(GpWorld * world, _Pair * pair)
+{
+	GpProgram * progs[] = {
+		_free_program(world),
+		_free_program(world),
+		_free_program(world),
+		_free_program(world)
+	};
+
+	gp_tournament_sort(world, progs);
+
+	// Ties may leave a program drawn twice both a parent and a loser
+	if (progs[2] == progs[3] || progs[2] == progs[0] || progs[2] == progs[1]
+		|| progs[3] == progs[0] || progs[3] == progs[1])
+		return 0;
+
+	pair->losers[0] = progs[2];
+	pair->losers[1] = progs[3];
+	pair->threshold = progs[3]->fitness;
+	progs[2]->_busy = progs[3]->_busy = 1;
+
+	progs[2] = pair->children;
+	progs[3] = pair->children + 1;
+	gp_world_vary(world, progs);
+	return 1;
+}
+
+// Put a pair's scored offspring in place of its losers
+static void _commit(_Pair * pair)
+{
+	for (uint i = 0; i < 2; i++) {
+		GpProgram * child = pair->children + i;
+		GpProgram * loser = pair->losers[i];
+		GpStatement * stmts = loser->stmts;
+
+		loser->stmts = child->stmts;
+		loser->num_stmts = child->num_stmts;
+		loser->fitness = child->fitness;
+		loser->evaluated = 1;
+		loser->approximate = child->approximate;
+		loser->_busy = 0;
+		child->stmts = stmts;
+	}
+}
+
+//
+// Commits swap statement buffers, so when the run ends some population
+// programs point into the spares' buffer while some spares hold population
+// buffers. Copy those programs back into population buffers.
+//
+static void _return_buffers(GpWorld * world, _Pipeline * pipe, uint num_pairs, GpStatement * stmt_buf)
+{
+	const uint max_length = world->conf.max_program_length;
+	GpStatement * const spare_end = stmt_buf + num_pairs * 2 * max_length;
+	uint s = 0;
+
+	for (uint i = 0; i < world->conf.population_size; i++)
+	{
+		GpProgram * program = world->programs + i;
+		if (program->stmts < stmt_buf || program->stmts >= spare_end)
+			continue;
+
+		// Find the next spare holding a population buffer
+		GpProgram * spare;
+		do {
+			spare = pipe->pairs[s / 2].children + s % 2;
+			s++;
+		} while (spare->stmts >= stmt_buf && spare->stmts < spare_end);
+
+		memcpy(spare->stmts, program->stmts, program->num_stmts * sizeof(GpStatement));
+		GpStatement * stmts = program->stmts;
+		program->stmts = spare->stmts;
+		spare->stmts = stmts;
+	}
+}
+
+//
+// `gp_world_evolve_pipelined` runs the pipeline until `times` steps have
+// been committed or, if `nsecs` is positive, until that many seconds have
+// passed. The evaluator must be safe to call from several threads at once.
+// Returns 0, having done nothing, for worlds the pipeline doesn't support
+// (deferred evaluation, case sampling, lexicase selection, cached case
+// errors) or that have only one thread.
+//
+int gp_world_evolve_pipelined(GpWorld * world, uint times, float nsecs)
+{
+	const uint num_evaluators = gp_pool_size(world->conf.num_threads) - 1;
+	const uint max_length = world->conf.max_program_length;
+	uint i;
+
+	if (num_evaluators == 0 || world->_pending != NULL || world->_sample.cases != NULL
+		|| world->conf.selection != GP_SELECT_TOURNAMENT || world->_case_errors != NULL)
+		return 0;
+
+	uint num_pairs = world->conf.pipeline_depth > 0 ?
+		world->conf.pipeline_depth : num_evaluators * 4;
+	num_pairs = gp_max(umin(num_pairs, world->conf.population_size / 8), 1);
+
+	_Pipeline pipe;
+	pipe.world = world;
+	pipe.pairs = new_array(_Pair, num_pairs);
+	pipe.stop = 0;
+	pipe.starved = 0;
+	pipe.sleepers = 0;
+	pipe.breeder_sleeps = 0;
+	pthread_mutex_init(&pipe.lock, NULL);
+	pthread_cond_init(&pipe.work_ready, NULL);
+	pthread_cond_init(&pipe.scored, NULL);
+	_queue_init(&pipe.work_queue, num_pairs);
+	_queue_init(&pipe.scored_queue, num_pairs);
+
+	GpStatement * stmt_buf = new_array(GpStatement, num_pairs * 2 * max_length);
+	uint * free_pairs = new_array(uint, num_pairs);
+	uint num_free = num_pairs;
+	for (i = 0; i < num_pairs; i++) {
+		for (uint c = 0; c < 2; c++) {
+			GpProgram * child = pipe.pairs[i].children + c;
+			child->stmts = stmt_buf + (i * 2 + c) * max_length;
+			child->num_stmts = 0;
+			child->id = (uint)-1;
+			child->evaluated = 0;
+			child->approximate = 0;
+			child->_busy = 0;
+		}
+		free_pairs[i] = i;
+	}
+
+	_Evaluator * evaluators = new_array(_Evaluator, num_evaluators);
+	for (i = 0; i < num_evaluators; i++) {
+		evaluators[i].pipe = &pipe;
+		evaluators[i].seed = gp_rand_next(&world->_rand);
+		pthread_create(&evaluators[i].thread, NULL, &_evaluator_main, evaluators + i);
+	}
+
+	const double deadline = gp_now() + nsecs;
+	uint issued = 0, stalls = 0;
+	double depth_sum = 0;
+	uint depth_samples = 0;
+
+	gp_world_use_rand(world);
+
+	for (;;)
+	{
+		const uint step = world->stats.total_steps;
+		int progress = 0;
+		uint p;
+
+		while (_queue_pop(&pipe.scored_queue, &p)) {
+			_commit(pipe.pairs + p);
+			world->stats.total_screened += pipe.pairs[p].screened;
+			world->stats.total_steps++;
+			free_pairs[num_free++] = p;
+			progress = 1;
+		}
+
+		// Intron removal moves no programs, so reserved losers stay put
+		if (world->conf.auto_optimize && world->stats.total_steps / 300000 != step / 300000)
+			gp_world_optimize(world);
+
+		const int more = nsecs > 0 ? gp_now() < deadline : issued < times;
+		if (!more && num_free == num_pairs)
+			break;
+
+		if (more && num_free > 0)
+		{
+			p = free_pairs[num_free - 1];
+			issued++;
+			if (!_breed(world, pipe.pairs + p)) {
+				world->stats.total_steps++;
+				continue;
+			}
+
+			depth_sum += _queue_depth(&pipe.work_queue);
+			depth_samples++;
+			num_free--;
+			_queue_push(&pipe.work_queue, p);
+			_wake_evaluators(&pipe, 0);
+		}
+		else if (!progress)
+		{
+			// Everything is in flight (or draining): wait for evaluators
+			if (more)
+				stalls++;
+			_await_scored(&pipe);
+		}
+	}
+
+	__atomic_store_n(&pipe.stop, 1, __ATOMIC_RELEASE);
+	_wake_evaluators(&pipe, 1);
+	for (i = 0; i < num_evaluators; i++)
+		pthread_join(evaluators[i].thread, NULL);
+
+	world->stats.pipeline_stalls += stalls;
+	world->stats.pipeline_starved += pipe.starved;
+	world->stats.pipeline_depth = depth_samples > 0 ? depth_sum / depth_samples : 0;
+
+	_return_buffers(world, &pipe, num_pairs, stmt_buf);
+
+	pthread_mutex_destroy(&pipe.lock);
+	pthread_cond_destroy(&pipe.work_ready);
+	pthread_cond_destroy(&pipe.scored);
+	delete(evaluators);
+	delete(free_pairs);
+	delete(pipe.work_queue.cells);
+	delete(pipe.scored_queue.cells);
+	delete(pipe.pairs);
+	delete(stmt_buf);
+	return 1;
+}
@@ -0,0 +1,177 @@
+//
+// _pool.c_ keeps a set of worker threads alive for the lifetime of a world,
+// so that parallel loops (breeding a generation, scoring a batch of
+// offspring) don't pay for creating threads each time. The calling thread
+// takes part in every loop, so a pool of `n` threads starts `n - 1`.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "gp.h"
+#include "mem.h"
+#include "pool.h"
+#include "numa.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+struct GpPool_ {
+	uint num_threads;
+	uint num_nodes;
+	pthread_t * threads;
+	GpRand * rngs;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	uint job;
+	uint busy;
+	int stop;
+	int running;
+
+	GpTask task;
+	void * arg;
+	uint count;
+	uint next;
+};
+
+typedef struct {
+	GpPool * pool;
+	uint index;
+} _Start;
+
+// Run iterations of the current loop until none are left
+static void _work(GpPool * pool)
+{
+	for (;;) {
+		const uint i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+		if (i >= pool->count)
+			break;
+		pool->task(pool->arg, i);
+	}
+}
+
+static void * _pool_thread(void * arg)
+{
+	GpPool * pool = ((_Start *)arg)->pool;
+	const uint index = ((_Start *)arg)->index;
+	uint job = 0;
+
+	delete(arg);
+	_gp_rng = pool->rngs + index;
+	if (pool->num_nodes > 0)
+		gp_numa_pin(index % pool->num_nodes);
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;)
+	{
+		while (!pool->stop && pool->job == job)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->stop)
+			break;
+		job = pool->job;
+		pthread_mutex_unlock(&pool->lock);
+
+		_work(pool);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+// Number of threads to use when `requested` of them were asked for: one
+// per online CPU if 0.
+uint gp_pool_size(uint requested)
+{
+	if (requested > 0)
+		return requested;
+
+	const long online = sysconf(_SC_NPROCESSORS_ONLN);
+	return online > 0 ? (uint)online : 1;
+}
+
+//
+// `gp_pool_new` starts a pool for loops spread over `num_threads` threads.
+// Each worker gets its own random number engine: in SFMT mode seeded from
+// `rng`, in counter mode sharing its key, so that tasks which pick their
+// own streams draw the same values on any thread. If `num_nodes` is set,
+// the workers are pinned to that many NUMA nodes in turn.
+//
+GpPool * gp_pool_new(uint num_threads, uint num_nodes, GpRand * rng)
+{
+	GpPool * pool = new(GpPool);
+	pool->num_threads = num_threads;
+	pool->num_nodes = num_nodes;
+	pool->threads = new_array(pthread_t, num_threads);
+	pool->rngs = new_array(GpRand, num_threads);
+	pool->job = 0;
+	pool->busy = 0;
+	pool->stop = 0;
+	pool->running = 0;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (uint i = 1; i < num_threads; i++) {
+		_Start * start = new(_Start);
+		start->pool = pool;
+		start->index = i;
+		gp_rand_seed(pool->rngs + i, rng->mode == GP_RAND_COUNTER ? rng->key : gp_rand_next(rng), rng->mode);
+		pthread_create(pool->threads + i, NULL, &_pool_thread, start);
+	}
+
+	return pool;
+}
+
+// `gp_pool_run` calls `task(arg, i)` for every `i` below `count`, spread
+// over the pool's threads, and returns once all of them are done. A loop
+// started while another is running, from one of its tasks or from another
+// thread, runs on the calling thread alone.
+void gp_pool_run(GpPool * pool, GpTask task, void * arg, uint count)
+{
+	if (__atomic_exchange_n(&pool->running, 1, __ATOMIC_ACQUIRE)) {
+		for (uint i = 0; i < count; i++)
+			task(arg, i);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->task = task;
+	pool->arg = arg;
+	pool->count = count;
+	pool->next = 0;
+	pool->busy = pool->num_threads - 1;
+	pool->job++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	_work(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	__atomic_store_n(&pool->running, 0, __ATOMIC_RELEASE);
+}
+
+void gp_pool_delete(GpPool * pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (uint i = 1; i < pool->num_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	delete(pool->threads);
+	delete(pool->rngs);
+	delete(pool);
+}
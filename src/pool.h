@@ -0,0 +1,22 @@
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+//
+// A persistent pool of worker threads that run parallel loops (see
+// _pool.c_). Not part of the public interface.
+//
+
+#include "gp.h"
+
+typedef struct GpPool_ GpPool;
+
+// One iteration of a parallel loop
+typedef void (*GpTask)(void * arg, uint index);
+
+uint     gp_pool_size   (uint);
+GpPool * gp_pool_new    (uint, uint, GpRand *);
+void     gp_pool_run    (GpPool *, GpTask, void *, uint);
+void     gp_pool_delete (GpPool *);
+
+#endif
@@ -0,0 +1,199 @@
+//
+// _predictor.c_ implements co-evolved fitness predictors (Schmidt & Lipson).
+// A predictor is a small subset of the fitness cases. A second, tiny
+// population of predictors evolves alongside the programs, rewarded for
+// ranking a set of "trainer" programs the same way the full dataset does.
+// Offspring are then scored only on the cases of the best predictor, so
+// they are scored on a few highly discriminative cases rather than on all
+// of them.
+//
+// Predictors breed every `sample_interval` steps, through
+// `gp_world_resample` with `sample_mode` set to `GP_SAMPLE_PREDICTORS`.
+//
+
+#include "gp.h"
+#include "mem.h"
+#include "evaluate.h"
+
+#include <string.h>
+
+// Number of random programs considered each time a trainer is replaced
+#define GP_TRAINER_CANDIDATES 8
+
+static inline uint * _predictor(GpWorld * world, uint p)
+{
+	return world->_predictors.cases + p * world->_sample.size;
+}
+
+//
+// A predictor is scored by how many pairs of trainers it ranks differently
+// from their exact fitness. Its mean absolute error is folded in as a
+// fraction below one, so it only breaks ties.
+//
+static float _predictor_fitness(GpWorld * world, uint p)
+{
+	const uint num_trainers = world->conf.num_trainers;
+	const gp_fitness_t * exact = world->_predictors.trainer_fitness;
+	gp_fitness_t predicted[num_trainers];
+	gp_fitness_t error = 0;
+	uint discordant = 0;
+	uint t, u;
+
+	for (t = 0; t < num_trainers; t++) {
+		predicted[t] = gp_cases_fitness(world, world->_predictors.trainers + t,
+			_predictor(world, p), world->_sample.size);
+		error += predicted[t] > exact[t] ? predicted[t] - exact[t] : exact[t] - predicted[t];
+	}
+
+	for (t = 0; t < num_trainers; t++)
+		for (u = t + 1; u < num_trainers; u++)
+			if ((predicted[t] - predicted[u]) * (exact[t] - exact[u]) < 0)
+				discordant++;
+
+	error /= num_trainers;
+	return discordant + error / (1 + error);
+}
+
+// Copy `program` into trainer slot `t` and score it on every case
+static void _set_trainer(GpWorld * world, uint t, GpProgram * program)
+{
+	GpProgram * trainer = world->_predictors.trainers + t;
+	gp_program_copy(program, trainer);
+	world->_predictors.trainer_fitness[t] = gp_full_fitness(world, trainer);
+}
+
+//
+// Replace the oldest trainer with the program the predictors disagree
+// about most (the one whose predicted fitness varies most between them),
+// since that is the program that best tells good predictors from bad.
+//
+static void _replace_trainer(GpWorld * world)
+{
+	const uint num_predictors = world->conf.num_predictors;
+	GpProgram * best = NULL;
+	gp_fitness_t best_variance = -1;
+
+	for (uint i = 0; i < GP_TRAINER_CANDIDATES; i++)
+	{
+		GpProgram * program = world->programs + urand(0, world->conf.population_size);
+		gp_fitness_t sum = 0, sum_sq = 0;
+
+		for (uint p = 0; p < num_predictors; p++) {
+			const gp_fitness_t f = gp_cases_fitness(world, program,
+				_predictor(world, p), world->_sample.size);
+			sum += f;
+			sum_sq += f * f;
+		}
+
+		const gp_fitness_t variance = sum_sq / num_predictors
+			- (sum / num_predictors) * (sum / num_predictors);
+		if (variance > best_variance) {
+			best_variance = variance;
+			best = program;
+		}
+	}
+
+	_set_trainer(world, world->_predictors.next_trainer, best);
+	world->_predictors.next_trainer = (world->_predictors.next_trainer + 1) % world->conf.num_trainers;
+}
+
+// Replace the worse half of the predictors with mutated one-point
+// crossovers of the better half.
+static void _breed_predictors(GpWorld * world)
+{
+	const uint num_predictors = world->conf.num_predictors;
+	const uint size = world->_sample.size;
+	const uint num_cases = world->conf.dataset->num_cases;
+	const float * fitness = world->_predictors.fitness;
+	uint order[num_predictors];
+	uint i, j;
+
+	// Insertion sort predictor indices, best first
+	for (i = 0; i < num_predictors; i++) {
+		for (j = i; j > 0 && fitness[order[j - 1]] > fitness[i]; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	const uint parents = (num_predictors + 1) / 2;
+	for (i = parents; i < num_predictors; i++)
+	{
+		const uint * mom = _predictor(world, order[urand(0, parents)]);
+		const uint * dad = _predictor(world, order[urand(0, parents)]);
+		uint * child = _predictor(world, order[i]);
+		const uint cp = urand(0, size + 1);
+
+		for (j = 0; j < size; j++) {
+			child[j] = j < cp ? mom[j] : dad[j];
+			if (urand(0, size) == 0)
+				child[j] = urand(0, num_cases);
+		}
+	}
+}
+
+void gp_predictors_init(GpWorld * world)
+{
+	const uint num_predictors = world->conf.num_predictors;
+	const uint num_trainers = world->conf.num_trainers;
+	const uint num_cases = world->conf.dataset->num_cases;
+	uint i;
+
+	world->_predictors.cases = new_array(uint, num_predictors * world->_sample.size);
+	world->_predictors.fitness = new_array(float, num_predictors);
+	world->_predictors.trainers = new_array(GpProgram, num_trainers);
+	world->_predictors.trainer_stmts = new_array(GpStatement, num_trainers * world->conf.max_program_length);
+	world->_predictors.trainer_fitness = new_array(gp_fitness_t, num_trainers);
+	world->_predictors.next_trainer = 0;
+	world->_predictors.best = num_predictors;
+
+	for (i = 0; i < num_predictors * world->_sample.size; i++)
+		world->_predictors.cases[i] = urand(0, num_cases);
+
+	for (i = 0; i < num_trainers; i++) {
+		GpProgram * trainer = world->_predictors.trainers + i;
+		trainer->id = (uint)-1;
+		trainer->stmts = world->_predictors.trainer_stmts + i * world->conf.max_program_length;
+		_set_trainer(world, i, world->programs + urand(0, world->conf.population_size));
+	}
+
+	for (i = 0; i < num_predictors; i++)
+		world->_predictors.fitness[i] = _predictor_fitness(world, i);
+}
+
+//
+// `gp_predictors_next` runs one generation of the predictor population and
+// installs the best predictor as the world's case sample. Returns nonzero
+// if the sample changed, meaning the programs need rescoring.
+//
+int gp_predictors_next(GpWorld * world)
+{
+	const uint num_predictors = world->conf.num_predictors;
+	uint best = 0;
+
+	_replace_trainer(world);
+	_breed_predictors(world);
+
+	for (uint i = 0; i < num_predictors; i++) {
+		world->_predictors.fitness[i] = _predictor_fitness(world, i);
+		if (world->_predictors.fitness[i] < world->_predictors.fitness[best])
+			best = i;
+	}
+
+	// The best half never breeds over itself, so an unchanged index means
+	// an unchanged predictor.
+	if (best == world->_predictors.best)
+		return 0;
+
+	world->_predictors.best = best;
+	memcpy(world->_sample.cases, _predictor(world, best), world->_sample.size * sizeof(uint));
+	return 1;
+}
+
+void gp_predictors_delete(GpWorld * world)
+{
+	delete(world->_predictors.cases);
+	delete(world->_predictors.fitness);
+	delete(world->_predictors.trainers);
+	delete(world->_predictors.trainer_stmts);
+	delete(world->_predictors.trainer_fitness);
+}
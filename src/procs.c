@@ -0,0 +1,353 @@
+//
+// _procs.c_ runs the evaluator in forked worker processes, used when
+// `num_processes` is set. It is meant for fitness code that isn't
+// thread-safe, or that may hang or crash. Each process scores one program
+// at a time. A process that runs for longer than `eval_timeout` seconds is
+// killed and replaced, and its program gets the worst possible fitness
+// (`FLT_MAX`, or `-FLT_MAX` when maximizing). A process that dies is
+// treated the same way.
+//
+// The world and its workers share a memory segment, made with
+// `memfd_create` where there is one. Each worker has its own slot in it.
+// A program is handed over by encoding it straight into the slot (see
+// `gp_program_encode`) and sending the worker a job number over its
+// socket. The worker writes the fitness back into the slot and returns
+// the number. An in-memory dataset is copied into the segment once, and
+// every worker, however often it is replaced, reads that copy.
+//
+// The world hands groups of programs to the pool as its `batch_evaluator`.
+// Several threads may use the pool at once, each with the idle workers it
+// claims, so threaded algorithms spread their evaluations over the
+// processes too.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "gp.h"
+#include "mem.h"
+#include "evolve.h"
+#include "evaluate.h"
+#include "os.h"
+
+#include <fcntl.h>
+#include <float.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef struct GpProcs_ GpProcs;
+
+// A worker's slot in the shared segment
+typedef struct {
+	uint count;
+	gp_fitness_t fitness;
+	uint8_t program[] __attribute__((aligned(8)));
+} _Slot;
+
+typedef struct {
+	pid_t pid;
+	int fd;
+	uint seq;
+	uint job;
+	double deadline;
+} _Worker;
+
+struct GpProcs_ {
+	gp_fitness_t (*evaluator)(GpWorld *, GpProgram *);
+	_Worker * workers;
+	uint num_workers;
+	uint * idle;
+	uint num_idle;
+	uint spawned;
+	pthread_mutex_t lock;
+	pthread_cond_t released;
+
+	uint8_t * shm;
+	size_t size;
+	size_t slot_size;
+	gp_num_t * rows;
+};
+
+static void _procs_err(const char * estr)
+{
+	printf("libgp procs ERROR: %s\n", estr);
+	abort();
+}
+
+static inline _Slot * _slot(GpProcs * procs, uint index)
+{
+	return (_Slot *)(procs->shm + index * procs->slot_size);
+}
+
+// An anonymous file to map the segment from
+static int _segment_fd(void)
+{
+#if defined(__linux__) && defined(SYS_memfd_create)
+	const int fd = (int)syscall(SYS_memfd_create, "libgp-procs", 0u);
+	if (fd >= 0)
+		return fd;
+#endif
+	char name[64];
+	static uint counter = 0;
+	snprintf(name, sizeof(name), "/libgp-procs-%ld-%u", (long)getpid(),
+		__atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED));
+	const int shm_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (shm_fd >= 0)
+		shm_unlink(name);
+	return shm_fd;
+}
+
+// The loop a worker process runs until the world closes its socket
+static void _worker_main(GpWorld * world, uint index, int fd, uint32_t seed)
+{
+	GpProcs * procs = world->_procs;
+	_Slot * slot = _slot(procs, index);
+	const gp_fitness_t worst = world->conf.minimize_fitness ? FLT_MAX : -FLT_MAX;
+	uint seq;
+
+	// The world's threads weren't forked along with it
+	world->_pool = NULL;
+	world->conf.evaluator = procs->evaluator;
+	world->conf.batch_evaluator = NULL;
+	if (procs->rows != NULL)
+		world->conf.dataset->rows = procs->rows;
+
+	GpRand rng;
+	gp_rand_seed(&rng, seed, GP_RAND_SFMT);
+	_gp_rng = &rng;
+
+	GpProgram program;
+	program.stmts = new_array(GpStatement, world->conf.max_program_length);
+	program.id = (uint)-1;
+	program._busy = 0;
+
+	while (read(fd, &seq, sizeof(seq)) == sizeof(seq))
+	{
+		if (gp_program_decode(world, slot->program, slot->count, &program))
+			slot->fitness = procs->evaluator(world, &program);
+		else
+			slot->fitness = worst;
+		if (write(fd, &seq, sizeof(seq)) != sizeof(seq))
+			break;
+	}
+	_exit(0);
+}
+
+// Start worker `i`. Called with the lock held, so that no other worker
+// inherits this one's end of its socket.
+static void _spawn(GpWorld * world, uint i)
+{
+	GpProcs * procs = world->_procs;
+	_Worker * worker = procs->workers + i;
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		_procs_err("cannot create a socket pair");
+
+	const uint32_t seed = world->conf.seed ^ (procs->spawned++ * 0x9E3779B9u);
+	const pid_t pid = fork();
+	if (pid < 0)
+		_procs_err("cannot fork a worker process");
+
+	if (pid == 0) {
+		close(fds[0]);
+		for (uint j = 0; j < procs->num_workers; j++)
+			if (j != i && procs->workers[j].fd >= 0)
+				close(procs->workers[j].fd);
+		_worker_main(world, i, fds[1], seed);
+	}
+
+	close(fds[1]);
+	worker->pid = pid;
+	worker->fd = fds[0];
+	worker->seq = 0;
+}
+
+static void _kill(_Worker * worker)
+{
+	close(worker->fd);
+	worker->fd = -1;
+	kill(worker->pid, SIGKILL);
+	waitpid(worker->pid, NULL, 0);
+}
+
+// Replace a worker that hung or died
+static void _respawn(GpWorld * world, uint i)
+{
+	pthread_mutex_lock(&world->_procs->lock);
+	_kill(world->_procs->workers + i);
+	_spawn(world, i);
+	pthread_mutex_unlock(&world->_procs->lock);
+}
+
+// Hand `program` to worker `i`. Called with the lock held.
+static void _start(GpWorld * world, uint i, GpProgram * program, uint job)
+{
+	GpProcs * procs = world->_procs;
+	_Worker * worker = procs->workers + i;
+	_Slot * slot = _slot(procs, i);
+
+	slot->count = gp_program_encode(world, program, slot->program);
+	worker->job = job;
+	worker->deadline = gp_now() + world->conf.eval_timeout;
+
+	// A worker that died while idle is replaced on the spot
+	while (worker->seq++, send(worker->fd, &worker->seq, sizeof(worker->seq), MSG_NOSIGNAL) != sizeof(worker->seq)) {
+		_kill(worker);
+		_spawn(world, i);
+	}
+}
+
+//
+// `gp_procs_init` forks `num_processes` workers for the world, which
+// from then on scores its programs through them.
+//
+void gp_procs_init(GpWorld * world)
+{
+	const uint n = world->conf.num_processes;
+	GpDataset * ds = world->conf.dataset;
+	uint i;
+
+	GpProcs * procs = new(GpProcs);
+	world->_procs = procs;
+	procs->evaluator = world->conf.evaluator;
+	procs->workers = new_array(_Worker, n);
+	procs->num_workers = n;
+	procs->idle = new_array(uint, n);
+	procs->num_idle = n;
+	procs->spawned = 0;
+	pthread_mutex_init(&procs->lock, NULL);
+	pthread_cond_init(&procs->released, NULL);
+
+	const size_t max_bytes = 2 + world->conf.max_program_length * GP_STMT_BYTES;
+	const size_t rows_size = ds != NULL ? (size_t)ds->capacity * (ds->num_inputs + 1) * sizeof(gp_num_t) : 0;
+	procs->slot_size = (sizeof(_Slot) + max_bytes + 63) & ~(size_t)63;
+	procs->size = n * procs->slot_size + rows_size;
+
+	const int fd = _segment_fd();
+	if (fd < 0 || ftruncate(fd, (off_t)procs->size) != 0)
+		_procs_err("cannot create the shared segment");
+	procs->shm = mmap(NULL, procs->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (procs->shm == MAP_FAILED)
+		_procs_err("cannot map the shared segment");
+
+	procs->rows = NULL;
+	if (rows_size > 0) {
+		procs->rows = (gp_num_t *)(procs->shm + n * procs->slot_size);
+		memcpy(procs->rows, ds->rows, rows_size);
+	}
+
+	for (i = 0; i < n; i++)
+		procs->workers[i].fd = -1;
+
+	pthread_mutex_lock(&procs->lock);
+	for (i = 0; i < n; i++) {
+		_spawn(world, i);
+		procs->idle[i] = i;
+	}
+	pthread_mutex_unlock(&procs->lock);
+
+	world->conf.batch_evaluator = &gp_procs_evaluate;
+	world->conf.evaluator = &gp_batch_evaluate_one;
+}
+
+void gp_procs_delete(GpWorld * world)
+{
+	GpProcs * procs = world->_procs;
+
+	for (uint i = 0; i < procs->num_workers; i++)
+		_kill(procs->workers + i);
+
+	munmap(procs->shm, procs->size);
+	pthread_mutex_destroy(&procs->lock);
+	pthread_cond_destroy(&procs->released);
+	delete(procs->workers);
+	delete(procs->idle);
+	delete(procs);
+}
+
+//
+// `gp_procs_evaluate` scores `count` programs on the worker processes,
+// handing each to the next idle worker, and writes their fitness to
+// `fitness`.
+//
+void gp_procs_evaluate(GpWorld * world, GpProgram ** programs, uint count, gp_fitness_t * fitness)
+{
+	GpProcs * procs = world->_procs;
+	const gp_fitness_t worst = world->conf.minimize_fitness ? FLT_MAX : -FLT_MAX;
+	const float timeout = world->conf.eval_timeout;
+	uint * mine = new_array(uint, procs->num_workers);
+	struct pollfd * fds = new_array(struct pollfd, procs->num_workers);
+	uint next = 0, done = 0, num_mine = 0;
+	uint i;
+
+	while (done < count)
+	{
+		// Claim idle workers for the programs not yet handed out, waiting
+		// for one only while none of ours are busy
+		pthread_mutex_lock(&procs->lock);
+		while (next < count && num_mine == 0 && procs->num_idle == 0)
+			pthread_cond_wait(&procs->released, &procs->lock);
+		while (next < count && procs->num_idle > 0) {
+			mine[num_mine] = procs->idle[--procs->num_idle];
+			_start(world, mine[num_mine++], programs[next], next);
+			next++;
+		}
+		pthread_mutex_unlock(&procs->lock);
+
+		double now = gp_now();
+		int wait_ms = -1;
+		for (i = 0; i < num_mine; i++) {
+			const _Worker * worker = procs->workers + mine[i];
+			fds[i].fd = worker->fd;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+			if (timeout > 0) {
+				const int left = (int)((worker->deadline - now) * 1000) + 1;
+				wait_ms = wait_ms < 0 ? gp_max(left, 0) : gp_min(wait_ms, gp_max(left, 0));
+			}
+		}
+		poll(fds, num_mine, wait_ms);
+		now = gp_now();
+
+		for (i = num_mine; i-- > 0; )
+		{
+			_Worker * worker = procs->workers + mine[i];
+			const uint job = worker->job;
+			uint seq;
+
+			if (fds[i].revents != 0) {
+				const ssize_t got = recv(worker->fd, &seq, sizeof(seq), 0);
+				if (got == sizeof(seq) && seq == worker->seq)
+					fitness[job] = _slot(procs, mine[i])->fitness;
+				else {
+					_respawn(world, mine[i]);
+					fitness[job] = worst;
+					__atomic_fetch_add(&world->stats.eval_crashes, 1, __ATOMIC_RELAXED);
+				}
+			} else if (timeout > 0 && now >= worker->deadline) {
+				_respawn(world, mine[i]);
+				fitness[job] = worst;
+				__atomic_fetch_add(&world->stats.eval_timeouts, 1, __ATOMIC_RELAXED);
+			} else
+				continue;
+
+			pthread_mutex_lock(&procs->lock);
+			procs->idle[procs->num_idle++] = mine[i];
+			pthread_cond_signal(&procs->released);
+			pthread_mutex_unlock(&procs->lock);
+			mine[i] = mine[--num_mine];
+			done++;
+		}
+	}
+
+	delete(mine);
+	delete(fds);
+}
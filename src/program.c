@@ -1,14 +1,17 @@
 
 #include "gp.h"
 #include "mem.h"
+#include "evolve.h"
 
 #include <string.h>
 
 // A statement is created as a random operation with random arguments.
-// Each argument can be a register, constant, or input.
+// Each argument can be a register, constant, or input. Without an input
+// bank, inputs are preloaded into the first registers instead.
 GpStatement gp_statement_random(GpWorld * world)
 {
 	uint j;
+	const uint kinds = world->conf.input_bank && world->conf.num_inputs > 0 ? 3 : 2;
 
 	GpStatement stmt;
 	stmt.output = urand(0, world->conf.num_registers);
@@ -16,15 +19,19 @@ GpStatement gp_statement_random(GpWorld * world)
 
 	for (j = 0; j < stmt.op->num_args; j++)
 	{
-		if (urand(0, 2))
-		{
-			stmt.args[j].type = GP_ARG_REGISTER;
-			stmt.args[j].data.reg = urand(0, world->conf.num_registers);
-		}
-		else
+		switch (urand(0, kinds))
 		{
+		case 0:
 			stmt.args[j].type = GP_ARG_CONSTANT;
 			stmt.args[j].data.num = world->conf.constant_func();
+			break;
+		case 1:
+			stmt.args[j].type = GP_ARG_REGISTER;
+			stmt.args[j].data.reg = urand(0, world->conf.num_registers);
+			break;
+		default:
+			stmt.args[j].type = GP_ARG_INPUT;
+			stmt.args[j].data.input = urand(0, world->conf.num_inputs);
 		}
 	}
 	return stmt;
@@ -36,6 +43,8 @@ void gp_program_init(GpWorld * world, GpProgram * program)
 {
 	uint i;
 	program->evaluated = 0;
+	program->approximate = 0;
+	program->id = (uint)-1;
 	program->num_stmts = urand(world->conf.min_program_length,
 							   world->conf.max_program_length + 1);
 	program->stmts = new_array(GpStatement, program->num_stmts);
@@ -54,6 +63,7 @@ GpProgram * gp_program_new(GpWorld * world)
 void gp_program_copy(GpProgram * src, GpProgram * dst)
 {
 	dst->evaluated = src->evaluated;
+	dst->approximate = src->approximate;
 	dst->fitness = src->fitness;
 	dst->num_stmts = src->num_stmts;
 	memcpy(dst->stmts, src->stmts, dst->num_stmts * sizeof(GpStatement));
@@ -95,6 +105,9 @@ static void _print_arg(FILE * f, GpArg arg)
 	case GP_ARG_CONSTANT:
 		fprintf(f, "%f",  arg.data.num);
 		break;
+	case GP_ARG_INPUT:
+		fprintf(f, "i%u", arg.data.input);
+		break;
 	default:
 		fprintf(f, "<unknown>");
 	}
@@ -124,15 +137,20 @@ void gp_program_export_python(FILE * f, GpWorld * world, GpProgram * program)
 	uint i, j;
 	fprintf(f, "def f(");
 
-	for (i = 0; i < world->conf.num_inputs - 1; i++)
-		fprintf(f, "i%d, ", i);
+	for (i = 0; i < world->conf.num_inputs; i++)
+		fprintf(f, i + 1 < world->conf.num_inputs ? "i%d, " : "i%d", i);
 
-	fprintf(f, "i%d):\n    ", i);
+	fprintf(f, "):\n    ");
 
 	for (i = 0; i < world->conf.num_registers; i++)
 		fprintf(f, "r%d = ", i);
 	fprintf(f, "0\n");
 
+	// Without an input bank the inputs start out in the first registers
+	if (!world->conf.input_bank)
+		for (i = 0; i < world->conf.num_inputs; i++)
+			fprintf(f, "    r%d = i%d\n", i, i);
+
 	for (i = 0; i < program->num_stmts; i++)
 	{
 		GpStatement * stmt = &program->stmts[i];
@@ -161,17 +179,21 @@ void gp_program_export_python(FILE * f, GpWorld * world, GpProgram * program)
 
 static GpState _initialState = {
 	.registers = {0, 0, 0, 0, 0}, // MUST MATCH GP_MAX_REGISTERS
+	.inputs = NULL,
 	.ip = 0
 };
 
 // `gp_program_run` will execute the supplied `program` given inputs
-// and return the final run state
+// and return the final run state. With an input bank the inputs are read
+// in place rather than copied into the registers.
 GpState gp_program_run(GpWorld * world, GpProgram * program, gp_num_t * inputs)
 {
 	GpState state = _initialState;
+	state.inputs = inputs;
 
-	for (uint i = 0; i < world->conf.num_inputs; i++)
-		state.registers[i] = inputs[i];
+	if (!world->conf.input_bank)
+		for (uint i = 0; i < world->conf.num_inputs; i++)
+			state.registers[i] = inputs[i];
 
 	while (state.ip < program->num_stmts)
 	{
@@ -181,3 +203,113 @@ GpState gp_program_run(GpWorld * world, GpProgram * program, gp_num_t * inputs)
 	}
 	return state;
 }
+
+//
+// ## Program encoding ##
+//
+// A program is its statement count (16 bits) followed by its statements.
+// A statement is its operation's index in `conf.ops` and its output
+// register (a byte each), then for each argument a type byte followed by
+// either a constant's bytes or a 16-bit register or input index. Op
+// indexes rather than pointers keep programs meaningful in any process
+// configured with the same ops.
+//
+
+static inline uint8_t * _put16(uint8_t * p, uint value)
+{
+	const uint16_t v = (uint16_t)value;
+	memcpy(p, &v, 2);
+	return p + 2;
+}
+
+static inline const uint8_t * _get16(const uint8_t * p, uint * value)
+{
+	uint16_t v;
+	memcpy(&v, p, 2);
+	*value = v;
+	return p + 2;
+}
+
+// `gp_program_encode` writes `program` to `out`, which must have room for
+// `2 + num_stmts * GP_STMT_BYTES` bytes, and returns the number written.
+uint gp_program_encode(GpWorld * world, GpProgram * program, uint8_t * out)
+{
+	uint8_t * p = _put16(out, program->num_stmts);
+
+	for (uint i = 0; i < program->num_stmts; i++)
+	{
+		GpStatement * stmt = program->stmts + i;
+		*p++ = (uint8_t)(stmt->op - world->conf.ops);
+		*p++ = (uint8_t)stmt->output;
+
+		for (uint j = 0; j < stmt->op->num_args; j++) {
+			GpArg * arg = stmt->args + j;
+			*p++ = (uint8_t)arg->type;
+			if (arg->type == GP_ARG_CONSTANT) {
+				memcpy(p, &arg->data.num, sizeof(gp_num_t));
+				p += sizeof(gp_num_t);
+			} else
+				p = _put16(p, arg->type == GP_ARG_REGISTER ? arg->data.reg : arg->data.input);
+		}
+	}
+
+	return p - out;
+}
+
+//
+// `gp_program_decode` reads `count` bytes into `program`. Returns 0 if
+// they don't make a valid program for this world, as they would from a
+// process configured differently.
+//
+int gp_program_decode(GpWorld * world, const uint8_t * bytes, uint count, GpProgram * program)
+{
+	const uint8_t * p = bytes;
+	const uint8_t * end = bytes + count;
+	uint num_stmts, index;
+
+	if (count < 2)
+		return 0;
+	p = _get16(p, &num_stmts);
+	if (num_stmts < 1 || num_stmts > world->conf.max_program_length)
+		return 0;
+
+	for (uint i = 0; i < num_stmts; i++)
+	{
+		GpStatement * stmt = program->stmts + i;
+		if (end - p < 2 || p[0] >= world->conf.num_ops || p[1] >= world->conf.num_registers)
+			return 0;
+		stmt->op = world->conf.ops + *p++;
+		stmt->output = *p++;
+
+		for (uint j = 0; j < stmt->op->num_args; j++)
+		{
+			GpArg * arg = stmt->args + j;
+			if (end - p < 1)
+				return 0;
+			arg->type = (GpArgType)*p++;
+
+			if (arg->type == GP_ARG_CONSTANT) {
+				if (end - p < (long)sizeof(gp_num_t))
+					return 0;
+				memcpy(&arg->data.num, p, sizeof(gp_num_t));
+				p += sizeof(gp_num_t);
+				continue;
+			}
+
+			if (end - p < 2)
+				return 0;
+			p = _get16(p, &index);
+			if (arg->type == GP_ARG_REGISTER && index < world->conf.num_registers)
+				arg->data.reg = index;
+			else if (arg->type == GP_ARG_INPUT && index < world->conf.num_inputs)
+				arg->data.input = index;
+			else
+				return 0;
+		}
+	}
+
+	program->num_stmts = num_stmts;
+	program->evaluated = 0;
+	program->approximate = 0;
+	return p == end;
+}
@@ -0,0 +1,85 @@
+//
+// _rand.c_ holds the random number engines behind `urand` and
+// `rand_double`.
+//
+
+#include "gp.h"
+
+// Philox4x32 multipliers and Weyl key increments
+#define GP_PHILOX_M0 0xD2511F53u
+#define GP_PHILOX_M1 0xCD9E8D57u
+#define GP_PHILOX_W0 0x9E3779B9u
+#define GP_PHILOX_W1 0xBB67AE85u
+#define GP_PHILOX_ROUNDS 10
+
+GpRand _gp_rand;
+__thread GpRand * _gp_rng = &_gp_rand;
+
+void gp_rand_seed(GpRand * rng, uint32_t seed, GpRandMode mode)
+{
+	rng->mode = mode;
+	rng->key = seed;
+	rng->ctr[0] = rng->ctr[1] = rng->ctr[2] = rng->ctr[3] = 0;
+
+	if (mode == GP_RAND_SFMT) {
+		sfmt_init_gen_rand(&rng->sfmt, seed);
+		rng->end = GP_RAND_BUFFER;
+	} else {
+		rng->end = GP_RAND_COUNTER_BLOCK;
+	}
+	rng->pos = rng->end;
+}
+
+//
+// Philox4x32-10 on `GP_RAND_COUNTER_BLOCK / 4` consecutive counters. The
+// counters are kept one per lane in separate arrays, so each round is the
+// same few operations on every lane and the compiler can vectorize it.
+//
+static void _philox_fill(GpRand * rng)
+{
+#define LANES (GP_RAND_COUNTER_BLOCK / 4)
+	uint32_t x0[LANES], x1[LANES], x2[LANES], x3[LANES];
+	uint32_t k0 = rng->key, k1 = 0;
+	uint l, r;
+
+	for (l = 0; l < LANES; l++) {
+		x0[l] = rng->ctr[0];
+		x1[l] = rng->ctr[1];
+		x2[l] = rng->ctr[2];
+		x3[l] = rng->ctr[3] + l;
+	}
+
+	for (r = 0; r < GP_PHILOX_ROUNDS; r++)
+	{
+		for (l = 0; l < LANES; l++) {
+			const uint64_t p0 = (uint64_t)GP_PHILOX_M0 * x0[l];
+			const uint64_t p1 = (uint64_t)GP_PHILOX_M1 * x2[l];
+			x0[l] = (uint32_t)(p1 >> 32) ^ x1[l] ^ k0;
+			x1[l] = (uint32_t)p1;
+			x2[l] = (uint32_t)(p0 >> 32) ^ x3[l] ^ k1;
+			x3[l] = (uint32_t)p0;
+		}
+		k0 += GP_PHILOX_W0;
+		k1 += GP_PHILOX_W1;
+	}
+
+	for (l = 0; l < LANES; l++) {
+		rng->buf[l * 4 + 0] = x0[l];
+		rng->buf[l * 4 + 1] = x1[l];
+		rng->buf[l * 4 + 2] = x2[l];
+		rng->buf[l * 4 + 3] = x3[l];
+	}
+
+	rng->ctr[3] += LANES;
+#undef LANES
+}
+
+// Generate the next block of values
+void gp_rand_fill(GpRand * rng)
+{
+	if (rng->mode == GP_RAND_SFMT)
+		sfmt_fill_array32(&rng->sfmt, rng->buf, GP_RAND_BUFFER);
+	else
+		_philox_fill(rng);
+	rng->pos = 0;
+}
@@ -0,0 +1,192 @@
+//
+// _select.c_ contains parent selection schemes other than the default
+// 4-way tournament. Lexicase selection picks a parent by filtering the
+// population one fitness case at a time, using the case x population
+// error matrix kept by the built-in evaluator.
+//
+
+#include "gp.h"
+#include "mem.h"
+
+#include <math.h>
+
+#ifdef HAVE_SSE2
+  #include <emmintrin.h>
+#endif
+
+// Smallest of `n` floats
+static float _min_float(const float * v, uint n)
+{
+	float m = INFINITY;
+	uint i = 0;
+
+#ifdef HAVE_SSE2
+	if (n >= 4)
+	{
+		__m128 vm = _mm_loadu_ps(v);
+		for (i = 4; i + 4 <= n; i += 4)
+			vm = _mm_min_ps(vm, _mm_loadu_ps(v + i));
+
+		float lanes[4];
+		_mm_storeu_ps(lanes, vm);
+		m = gp_min(gp_min(lanes[0], lanes[1]), gp_min(lanes[2], lanes[3]));
+	}
+#endif
+
+	for (; i < n; i++)
+		m = gp_min(m, v[i]);
+	return m;
+}
+
+// Write to `out` the entries of `ids` (or the indices themselves, if `ids`
+// is NULL) whose value in `v` is no greater than `limit`, and return how
+// many there were.
+static uint _filter(const float * v, const uint * ids, uint n, float limit, uint * out)
+{
+	uint i = 0, count = 0;
+
+#ifdef HAVE_SSE2
+	const __m128 vlimit = _mm_set1_ps(limit);
+	for (; i + 4 <= n; i += 4)
+	{
+		int mask = _mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(v + i), vlimit));
+		while (mask) {
+			const uint k = i + __builtin_ctz(mask);
+			out[count++] = ids == NULL ? k : ids[k];
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+	for (; i < n; i++)
+		if (v[i] <= limit)
+			out[count++] = ids == NULL ? i : ids[i];
+	return count;
+}
+
+// Median of `n` floats by quickselect. Reorders `v`.
+static float _median(float * v, uint n)
+{
+	uint lo = 0, hi = n - 1;
+	const uint k = n / 2;
+
+	while (lo < hi)
+	{
+		const float pivot = v[(lo + hi) / 2];
+		uint i = lo, j = hi;
+		while (i <= j) {
+			while (v[i] < pivot) i++;
+			while (v[j] > pivot) j--;
+			if (i <= j) {
+				const float tmp = v[i]; v[i] = v[j]; v[j] = tmp;
+				i++;
+				if (j == 0)
+					break;
+				j--;
+			}
+		}
+		if (k <= j)
+			hi = j;
+		else if (k >= i)
+			lo = i;
+		else
+			break;
+	}
+	return v[k];
+}
+
+//
+// Epsilon-lexicase treats every program within one median absolute
+// deviation of the best error on a case as elite on that case. The
+// epsilons only drift slowly, so they are recomputed once per generation.
+//
+static void _update_epsilon(GpWorld * world)
+{
+	GpDataset * ds = world->conf.dataset;
+	const uint popsize = world->conf.population_size;
+	float * values = world->_lexicase.values;
+
+	for (uint c = 0; c < ds->num_cases; c++)
+	{
+		const uint slot = gp_dataset_slot(ds, c);
+		const float * row = world->_case_errors + (size_t)slot * popsize;
+		uint i;
+
+		for (i = 0; i < popsize; i++)
+			values[i] = row[i];
+		const float median = _median(values, popsize);
+
+		for (i = 0; i < popsize; i++)
+			values[i] = fabsf(row[i] - median);
+		world->_lexicase.epsilon[slot] = _median(values, popsize);
+	}
+
+	world->_lexicase.epsilon_step = world->stats.total_steps + popsize / 2;
+}
+
+//
+// `gp_select_lexicase` picks one parent by lexicase selection. Cases are
+// visited in random order, and at each one only the programs with the
+// lowest error (plus epsilon, for epsilon-lexicase) survive, until a single
+// program is left or the cases run out. With `lexicase_cases` set, each
+// selection only considers that many randomly chosen cases, which bounds
+// its cost on large datasets. This matters most for epsilon-lexicase,
+// where wide epsilons can leave many programs alive for many cases.
+//
+// The first case is filtered over a full, contiguous row of the error
+// matrix. Later cases gather the survivors' errors into a scratch buffer,
+// which by then is usually only a handful of programs.
+//
+GpProgram * gp_select_lexicase(GpWorld * world)
+{
+	GpDataset * ds = world->conf.dataset;
+	const uint popsize = world->conf.population_size;
+	const uint num_cases = ds->num_cases;
+	const int epsilon = world->conf.selection == GP_SELECT_EPSILON_LEXICASE;
+	uint * cases = world->_lexicase.cases;
+	uint * candidates = world->_lexicase.candidates;
+	uint * survivors = world->_lexicase.survivors;
+	float * values = world->_lexicase.values;
+	uint n = popsize;
+	uint i, c;
+
+	if (num_cases == 0)
+		return world->programs + urand(0, popsize);
+
+	if (epsilon && world->stats.total_steps >= world->_lexicase.epsilon_step)
+		_update_epsilon(world);
+
+	// A window dataset may have changed size since the last selection
+	if (world->_lexicase.num_cases != num_cases) {
+		for (c = 0; c < num_cases; c++)
+			cases[c] = c;
+		world->_lexicase.num_cases = num_cases;
+	}
+
+	const uint max_cases = world->conf.lexicase_cases > 0 ?
+		umin(world->conf.lexicase_cases, num_cases) : num_cases;
+
+	for (c = 0; c < max_cases && n > 1; c++)
+	{
+		// Draw the next case with one step of a Fisher-Yates shuffle
+		const uint j = urand(c, num_cases);
+		const uint tmp = cases[c]; cases[c] = cases[j]; cases[j] = tmp;
+
+		const uint slot = gp_dataset_slot(ds, cases[c]);
+		const float * row = world->_case_errors + (size_t)slot * popsize;
+		const float eps = epsilon ? world->_lexicase.epsilon[slot] : 0;
+
+		if (c == 0) {
+			n = _filter(row, NULL, popsize, _min_float(row, popsize) + eps, survivors);
+		} else {
+			for (i = 0; i < n; i++)
+				values[i] = row[candidates[i]];
+			n = _filter(values, candidates, n, _min_float(values, n) + eps, survivors);
+		}
+
+		uint * swap = candidates; candidates = survivors; survivors = swap;
+	}
+
+	const uint id = c == 0 ? urand(0, popsize) : candidates[urand(0, n)];
+	return world->programs + world->_id_slots[id];
+}
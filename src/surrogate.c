@@ -0,0 +1,273 @@
+//
+// _surrogate.c_ pre-screens offspring with a surrogate fitness model,
+// used when `surrogate_neighbors` is set. It is meant for evaluators too
+// expensive to run on every child. Each program is described by a short
+// feature vector: its effective length, how often each operation appears
+// in its effective code, and its outputs on a few probe inputs. The
+// fitness of a new program is predicted from the `surrogate_neighbors`
+// nearest of the last `surrogate_memory` programs the real evaluator
+// scored, weighted by inverse distance.
+//
+// As with two-stage screening (see _evaluate.c_), only offspring predicted
+// to come within `screen_margin` of beating the tournament's losers are
+// passed on to the evaluator. A fraction `surrogate_explore` of the rest
+// are passed on anyway, so the model keeps learning about the programs it
+// would reject. The others keep their predicted fitness and are flagged
+// `approximate`. Every real score trains the model, and `surrogate_accuracy`
+// reports how often its verdict agreed with the evaluator's.
+//
+// The model is shared between threads, so threaded runs that use it
+// aren't reproducible.
+//
+
+#include "gp.h"
+#include "mem.h"
+#include "evolve.h"
+#include "evaluate.h"
+
+#include <math.h>
+#include <pthread.h>
+
+// Probe inputs each program is run on for its features
+#define GP_SURROGATE_PROBES 8
+
+typedef struct GpSurrogate_ GpSurrogate;
+
+struct GpSurrogate_ {
+	uint num_features;
+	gp_num_t * probes;
+	float * features;
+	gp_fitness_t * fitness;
+	uint size;
+	uint count;
+	uint next;
+	uint checked;
+	uint correct;
+	pthread_mutex_t lock;
+};
+
+//
+// `gp_surrogate_init` sets up an empty model. The probe inputs are evenly
+// strided dataset rows when there is a dataset, and constants from
+// `constant_func` otherwise.
+//
+void gp_surrogate_init(GpWorld * world)
+{
+	const uint num_inputs = world->conf.num_inputs;
+	GpDataset * ds = world->conf.dataset;
+	uint i, j;
+
+	GpSurrogate * model = new(GpSurrogate);
+	world->_surrogate = model;
+	model->num_features = 1 + world->conf.num_ops + GP_SURROGATE_PROBES;
+	model->size = world->conf.surrogate_memory;
+	model->features = new_array(float, (size_t)model->size * model->num_features);
+	model->fitness = new_array(gp_fitness_t, model->size);
+	model->count = model->next = 0;
+	model->checked = model->correct = 0;
+	pthread_mutex_init(&model->lock, NULL);
+
+	model->probes = new_array(gp_num_t, GP_SURROGATE_PROBES * num_inputs + 1);
+	for (i = 0; i < GP_SURROGATE_PROBES; i++)
+	{
+		gp_num_t * probe = model->probes + i * num_inputs;
+		if (ds != NULL && ds->num_cases > 0) {
+			const gp_num_t * row = gp_dataset_row(ds, (uint)((size_t)i * ds->num_cases / GP_SURROGATE_PROBES));
+			for (j = 0; j < num_inputs; j++)
+				probe[j] = row[j];
+		} else {
+			for (j = 0; j < num_inputs; j++)
+				probe[j] = world->conf.constant_func();
+		}
+	}
+}
+
+void gp_surrogate_delete(GpWorld * world)
+{
+	GpSurrogate * model = world->_surrogate;
+
+	pthread_mutex_destroy(&model->lock);
+	delete(model->probes);
+	delete(model->features);
+	delete(model->fitness);
+	delete(model);
+}
+
+// Fraction of its verdicts the evaluator agreed with
+float gp_surrogate_accuracy(GpWorld * world)
+{
+	GpSurrogate * model = world->_surrogate;
+	return model->checked > 0 ? model->correct / (float)model->checked : 0;
+}
+
+// A log scale, so wild outputs don't swamp every other feature
+static inline float _squash(gp_num_t value)
+{
+	const double magnitude = log1p(fmin(fabs((double)value), 1e30));
+	return (float)(value < 0 ? -magnitude : magnitude);
+}
+
+static void _features(GpWorld * world, GpProgram * program, float * features)
+{
+	GpSurrogate * model = world->_surrogate;
+	const uint num_ops = world->conf.num_ops;
+	int used_vars[GP_MAX_REGISTERS] = { 0 };
+	uint effective = 0;
+	uint i;
+
+	for (i = 0; i <= num_ops; i++)
+		features[i] = 0;
+
+	// Only the statements that reach the output, found as when removing
+	// introns (see _optimize.c_)
+	used_vars[0] = 1;
+	for (i = program->num_stmts; i-- > 0; )
+	{
+		GpStatement * stmt = program->stmts + i;
+		if (used_vars[stmt->output])
+		{
+			used_vars[stmt->output] = 0;
+			for (uint j = 0; j < stmt->op->num_args; j++)
+				if (stmt->args[j].type == GP_ARG_REGISTER)
+					used_vars[stmt->args[j].data.reg] = 1;
+			features[1 + (stmt->op - world->conf.ops)] += 1;
+			effective++;
+		}
+	}
+
+	for (i = 1; i <= num_ops; i++)
+		features[i] /= gp_max(effective, 1);
+	features[0] = effective / (float)world->conf.max_program_length;
+
+	for (i = 0; i < GP_SURROGATE_PROBES; i++) {
+		GpState state = gp_program_run(world, program, model->probes + i * world->conf.num_inputs);
+		features[1 + num_ops + i] = _squash(state.registers[0]);
+	}
+}
+
+// Predict the fitness of a program with `features` into `estimate`.
+// Returns 0 while the model has seen too few programs to tell.
+static int _predict(GpWorld * world, const float * features, gp_fitness_t * estimate)
+{
+	GpSurrogate * model = world->_surrogate;
+	const uint k = world->conf.surrogate_neighbors;
+	const uint num_features = model->num_features;
+	float distances[k];
+	uint nearest[k];
+	uint found = 0;
+
+	pthread_mutex_lock(&model->lock);
+
+	if (model->count < k) {
+		pthread_mutex_unlock(&model->lock);
+		return 0;
+	}
+
+	for (uint i = 0; i < model->count; i++)
+	{
+		const float * other = model->features + (size_t)i * num_features;
+		float distance = 0;
+		for (uint j = 0; j < num_features; j++)
+			distance += (features[j] - other[j]) * (features[j] - other[j]);
+
+		if (found == k && distance >= distances[k - 1])
+			continue;
+
+		// Insert into the sorted list of the nearest so far
+		uint at = found < k ? found++ : k - 1;
+		for (; at > 0 && distances[at - 1] > distance; at--) {
+			distances[at] = distances[at - 1];
+			nearest[at] = nearest[at - 1];
+		}
+		distances[at] = distance;
+		nearest[at] = i;
+	}
+
+	// A program seen before, such as an unchanged copy, keeps its score
+	if (distances[0] == 0)
+		*estimate = model->fitness[nearest[0]];
+	else {
+		double total = 0, weights = 0;
+		for (uint i = 0; i < k; i++) {
+			total += model->fitness[nearest[i]] / distances[i];
+			weights += 1 / distances[i];
+		}
+		*estimate = total / weights;
+	}
+
+	pthread_mutex_unlock(&model->lock);
+	return 1;
+}
+
+// Remember a real score, replacing the oldest one once the memory is full
+static void _train(GpSurrogate * model, const float * features, gp_fitness_t fitness)
+{
+	float * slot = model->features + (size_t)model->next * model->num_features;
+	for (uint j = 0; j < model->num_features; j++)
+		slot[j] = features[j];
+	model->fitness[model->next] = fitness;
+	model->next = (model->next + 1) % model->size;
+	model->count = umin(model->count + 1, model->size);
+}
+
+//
+// `gp_surrogate_evaluate` scores `count` offspring, each of which has to
+// beat the matching entry of `thresholds`. The ones the model rejects keep
+// its prediction, and the rest are scored together. Returns how many were
+// not passed on to the evaluator.
+//
+uint gp_surrogate_evaluate(GpWorld * world, GpProgram ** programs, const gp_fitness_t * thresholds, uint count)
+{
+	GpSurrogate * model = world->_surrogate;
+	const uint num_features = model->num_features;
+	float features[count * num_features];
+	gp_fitness_t estimates[count];
+	int verdicts[count];
+	GpProgram * forward[count];
+	uint num_forward = 0;
+	uint i;
+
+	for (i = 0; i < count; i++)
+	{
+		GpProgram * program = programs[i];
+		_features(world, program, features + i * num_features);
+
+		// Without a prediction, the program can only be passed on
+		verdicts[i] = -1;
+		if (_predict(world, features + i * num_features, estimates + i))
+			verdicts[i] = gp_within_margin(world, estimates[i], thresholds[i]);
+
+		program->evaluated = 1;
+		program->approximate = verdicts[i] == 0;
+		if (verdicts[i] == 0 && rand_double() < world->conf.surrogate_explore)
+			program->approximate = 0;
+
+		if (program->approximate)
+			program->fitness = estimates[i];
+		else
+			forward[num_forward++] = program;
+	}
+
+	if (world->conf.batch_evaluator != NULL)
+		gp_world_evaluate(world, forward, num_forward);
+	else
+		for (i = 0; i < num_forward; i++)
+			forward[i]->fitness = world->conf.evaluator(world, forward[i]);
+
+	pthread_mutex_lock(&model->lock);
+	for (i = 0; i < count; i++)
+	{
+		GpProgram * program = programs[i];
+		if (program->approximate)
+			continue;
+
+		if (verdicts[i] >= 0) {
+			model->checked++;
+			model->correct += verdicts[i] == gp_within_margin(world, program->fitness, thresholds[i]);
+		}
+		_train(model, features + i * num_features, program->fitness);
+	}
+	pthread_mutex_unlock(&model->lock);
+
+	return count - num_forward;
+}
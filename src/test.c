@@ -3,13 +3,18 @@
 // Contains methods for easily comparing world configurations and testing performance
 //
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "gp.h"
+#include "os.h"
 
 //
 // `gp_test_configurations` will compare a set of world configurations by initializing
 // a new world for each configuration in `confs`, running it for `iters` iterations,
 // and recording the resulting world stats.
-// Each configuration will be tested `num_times` times and the results will be averaged
+// Each configuration will be tested `num_times` times and the results will be averaged.
+// Worlds draw from the counter-based generator, so a configuration seeded with
+// `seed` gives the same results on any number of threads.
 //
 void gp_test_configurations_iters(GpWorldConf * confs, uint count, uint iters, uint num_times)
 {
@@ -26,7 +31,9 @@ void gp_test_configurations_iters(GpWorldConf * confs, uint count, uint iters, u
 		for (uint j = 0; j < num_times; j++)
 		{
 			GpWorld * world = gp_world_new();
-			gp_world_initialize(world, confs[i]);
+			GpWorldConf conf = confs[i];
+			conf.rand_mode = GP_RAND_COUNTER;
+			gp_world_initialize(world, conf);
 			gp_world_evolve_times(world, iters);
 
 			best_tot += world->stats.best_fitness;
@@ -63,7 +70,9 @@ void gp_test_configurations_secs(GpWorldConf * confs, uint count, float secs, ui
 		for (uint j = 0; j < num_times; j++)
 		{
 			GpWorld * world = gp_world_new();
-			gp_world_initialize(world, confs[i]);
+			GpWorldConf conf = confs[i];
+			conf.rand_mode = GP_RAND_COUNTER;
+			gp_world_initialize(world, conf);
 			iters_tot += gp_world_evolve_secs(world, secs);
 
 			best_tot += world->stats.best_fitness;
@@ -83,7 +92,47 @@ void gp_test_configurations_secs(GpWorldConf * confs, uint count, float secs, ui
 	}
 }
 
-void gp_test_performance()
+//
+// `gp_test_performance` evolves two worlds from `conf` with the counter-based
+// generator for `iters` steps, one with `gp_world_evolve_times` and one with
+// `gp_world_evolve_times_parallel`, and prints how long each took. Returns
+// nonzero if both end with the same population, as they should on any
+// number of threads.
+//
+int gp_test_performance(GpWorldConf conf, uint iters)
 {
+	GpWorld * worlds[2];
+	double secs[2];
+
+	conf.rand_mode = GP_RAND_COUNTER;
+	if (conf.seed == 0)
+		conf.seed = 1;
+
+	for (uint i = 0; i < 2; i++)
+	{
+		worlds[i] = gp_world_new();
+		gp_world_initialize(worlds[i], conf);
+
+		const double start = gp_now();
+		if (i == 0)
+			gp_world_evolve_times(worlds[i], iters);
+		else
+			gp_world_evolve_times_parallel(worlds[i], iters);
+		secs[i] = gp_now() - start;
+	}
+
+	int same = 1;
+	for (uint i = 0; i < conf.population_size && same; i++)
+	{
+		GpProgram * a = worlds[0]->programs + i;
+		GpProgram * b = worlds[1]->programs + i;
+		same = gp_program_equal(a, b) && a->fitness == b->fitness;
+	}
+
+	printf("Serial %-7.2fs Parallel %-7.2fs Populations %s\n",
+		secs[0], secs[1], same ? "match" : "DIFFER");
 
+	gp_world_delete(worlds[0]);
+	gp_world_delete(worlds[1]);
+	return same;
 }
@@ -1,41 +1,133 @@
+#define _POSIX_C_SOURCE 200809L
 
 #include "gp.h"
 #include "mem.h"
 #include "iqsort.h"
+#include "evaluate.h"
+#include "evolve.h"
+#include "pool.h"
+#include "numa.h"
+#include "os.h"
 
-#include <time.h>
 #include <string.h>
 
-sfmt_t _sfmt;
-static int _sfmt_has_init = 0;
+static int _rand_has_init = 0;
+
+// Cache budget for the offspring of one batch of tournaments
+#define GP_BATCH_CACHE_BYTES 32768
 
 // `gp_world_new` creates a new world with a default config.
 // After a world is created, custom configuration should be set and
 // the desired list of operations should be added with `gp_world_add_op`.
 GpWorld * gp_world_new()
 {
-	if (!_sfmt_has_init) {
-		sfmt_init_gen_rand(&_sfmt, time(NULL));
-		_sfmt_has_init = 1;
+	if (!_rand_has_init) {
+		gp_rand_seed(&_gp_rand, time(NULL), GP_RAND_SFMT);
+		_rand_has_init = 1;
 	}
 
 	GpWorld * world = new(GpWorld);
 	world->programs = NULL;
 
 	world->stats.total_steps = 0;
+	world->stats.total_screened = 0;
+	world->stats.pipeline_stalls = 0;
+	world->stats.pipeline_starved = 0;
+	world->stats.pipeline_depth = 0;
+	world->stats.numa_local = 0;
+	world->stats.numa_remote = 0;
+	world->stats.eval_timeouts = 0;
+	world->stats.eval_crashes = 0;
+	world->stats.farm_reassigned = 0;
+	world->stats.farm_local = 0;
+	world->stats.lazy_avoided = 0;
+	world->stats.surrogate_accuracy = 0;
 	world->stats.avg_fitness = 0;
 	world->stats.best_fitness = 0;
 
 	world->_stmt_buf = NULL;
 	world->_last_optimize = 0;
+	world->_pending = NULL;
+	world->_num_pending = 0;
+	world->_case_errors = NULL;
+	world->_error_totals = NULL;
+	world->_sample.cases = NULL;
+	world->_sample.order = NULL;
+	world->_sample.difficulty = NULL;
+	world->_sample.age = NULL;
+	world->_lexicase.cases = NULL;
+	world->_lexicase.candidates = NULL;
+	world->_lexicase.survivors = NULL;
+	world->_lexicase.values = NULL;
+	world->_lexicase.epsilon = NULL;
+	world->_id_slots = NULL;
+	world->_predictors.cases = NULL;
+	world->_screen_rows = NULL;
+	world->_batch.size = 1;
+	world->_batch.progs = NULL;
+	world->_batch.children = NULL;
+	world->_batch.thresholds = NULL;
+	world->_batch.marks = NULL;
+	world->_next.programs = NULL;
+	world->_next.stmt_buf = NULL;
+	world->_next.children = NULL;
+	world->_next.ids = NULL;
+	world->_next.drawn = NULL;
+	world->_pool = NULL;
+	world->_cells.offsets = NULL;
+	world->_numa_nodes = 1;
+	world->_procs = NULL;
+	world->_farm = NULL;
+	world->_surrogate = NULL;
+	world->_background = NULL;
 
 	return world;
 }
 
 void gp_world_delete(GpWorld * world)
 {
+	if (world->_background != NULL)
+		gp_background_finish(world);
+	if (world->_procs != NULL)
+		gp_procs_delete(world);
+	if (world->_farm != NULL)
+		gp_farm_delete(world);
+	if (world->_surrogate != NULL)
+		gp_surrogate_delete(world);
 	delete(world->programs);
 	delete(world->_stmt_buf);
+	delete(world->_pending);
+	delete(world->_case_errors);
+	delete(world->_error_totals);
+	delete(world->_sample.cases);
+	delete(world->_sample.order);
+	delete(world->_sample.difficulty);
+	delete(world->_sample.age);
+	delete(world->_lexicase.cases);
+	delete(world->_lexicase.candidates);
+	delete(world->_lexicase.survivors);
+	delete(world->_lexicase.values);
+	delete(world->_lexicase.epsilon);
+	delete(world->_id_slots);
+	if (world->_predictors.cases != NULL)
+		gp_predictors_delete(world);
+	delete(world->_screen_rows);
+	delete(world->_batch.progs);
+	delete(world->_batch.children);
+	delete(world->_batch.thresholds);
+	delete(world->_batch.marks);
+	delete(world->_next.programs);
+	delete(world->_next.stmt_buf);
+	delete(world->_next.children);
+	delete(world->_next.ids);
+	delete(world->_next.drawn);
+	if (world->_pool != NULL)
+		gp_pool_delete(world->_pool);
+	delete(world->_cells.offsets);
+
+	// Don't leave the calling thread drawing from a freed generator
+	if (_gp_rng == &world->_rand)
+		_gp_rng = &_gp_rand;
 	delete(world);
 }
 
@@ -55,7 +147,9 @@ GpWorldConf gp_world_conf_default()
 		.ops = _default_ops,
 		.num_ops = 5,
 		.evaluator = NULL,
+		.batch_evaluator = NULL,
 		.constant_func = NULL,
+		.dataset = NULL,
 		.population_size = 50000,
 		.num_inputs = 0,
 		.num_registers = 2,
@@ -65,10 +159,70 @@ GpWorldConf gp_world_conf_default()
 		.crossover_rate = 0.9,
 		.homologous_rate = 0.9,
 		.minimize_fitness = 0,
-		.auto_optimize = 1
+		.auto_optimize = 1,
+		.input_bank = 0,
+		.eval_batch_size = 0,
+		.sample_mode = GP_SAMPLE_ALL,
+		.sample_size = 256,
+		.sample_interval = 0,
+		.num_predictors = 8,
+		.num_trainers = 16,
+		.selection = GP_SELECT_TOURNAMENT,
+		.lexicase_cases = 0,
+		.screen_cases = 0,
+		.screen_margin = 0.1,
+		.num_threads = 0,
+		.seed = 0,
+		.rand_mode = GP_RAND_SFMT,
+		.tournament_batch = 1,
+		.algorithm = GP_STEADY_STATE,
+		.num_elites = 2,
+		.pipeline_depth = 0,
+		.neighborhood = GP_NEIGHBORHOOD_VON_NEUMANN,
+		.neighborhood_radius = 1,
+		.grid_width = 0,
+		.numa = GP_NUMA_OFF,
+		.numa_exchange = 0.1,
+		.split_threshold = 1000000,
+		.max_in_flight = 0,
+		.num_processes = 0,
+		.eval_timeout = 0,
+		.farm_workers = NULL,
+		.farm_window = 16,
+		.lazy_evaluation = 0,
+		.surrogate_neighbors = 0,
+		.surrogate_explore = 0.1,
+		.surrogate_memory = 1024,
+		.parallel_init = 0,
+		.background_init = 0
 	};
 }
 
+// Programs of the initial population written in one task
+#define GP_INIT_BLOCK 256
+
+// Write the random programs of the `k`th block of the initial population
+static void _init_block(void * arg, uint k)
+{
+	GpWorld * world = arg;
+	const uint first = k * GP_INIT_BLOCK;
+	const uint last = umin(first + GP_INIT_BLOCK, world->conf.population_size);
+
+	for (uint i = first; i < last; i++) {
+		GpProgram * program = world->programs + i;
+		gp_rand_stream(_gp_rng, 0, i, GP_STREAM_INIT);
+		program->evaluated = 0;
+		program->approximate = 0;
+		program->id = i;
+		program->_busy = 0;
+		program->stmts = world->_stmt_buf + i * world->conf.max_program_length;
+		program->num_stmts = urand(world->conf.min_program_length,
+			world->conf.max_program_length + 1);
+		for (uint j = 0; j < program->num_stmts; j++)
+			program->stmts[j] = gp_statement_random(world);
+	}
+}
+
 static void _init_err(const char * estr)
 {
 	printf("libgp init ERROR: %s\n", estr);
@@ -80,8 +234,14 @@ static void _init_err(const char * estr)
 // after calling this.
 void gp_world_initialize(GpWorld * world, GpWorldConf conf)
 {
-	if (conf.constant_func == NULL || conf.evaluator == NULL)
-		_init_err("constant_func or evaluator not defined");
+	if (conf.constant_func == NULL)
+		_init_err("constant_func not defined");
+
+	if (conf.evaluator == NULL && conf.batch_evaluator == NULL && conf.dataset == NULL)
+		_init_err("evaluator, batch_evaluator or dataset must be defined");
+
+	if (conf.dataset != NULL && conf.dataset->num_inputs != conf.num_inputs)
+		_init_err("dataset num_inputs does not match num_inputs");
 
 	if (conf.num_registers > GP_MAX_REGISTERS)
 		_init_err("num_registers is greater than GP_MAX_REGISTERS");
@@ -89,40 +249,345 @@ void gp_world_initialize(GpWorld * world, GpWorldConf conf)
 	if (conf.min_program_length < 3)
 		_init_err("min_program_length must be 3 or greater");
 
-	if (conf.max_program_length < world->conf.min_program_length)
-		_init_err("max_program_length cannot be greater than min_program_length");
+	if (conf.max_program_length < conf.min_program_length)
+		_init_err("max_program_length cannot be less than min_program_length");
 
 	if ((conf.population_size & 1) != 0)
 		_init_err("population size must be an even number");
 
-	if (conf.num_inputs > conf.num_registers)
-		_init_err("num_inputs cannot be greater than num_registers");
+	if (conf.num_inputs > conf.num_registers && !conf.input_bank)
+		_init_err("num_inputs cannot be greater than num_registers without an input_bank");
+
+	if (conf.sample_mode != GP_SAMPLE_ALL) {
+		if (conf.evaluator != NULL || conf.batch_evaluator != NULL || conf.dataset == NULL)
+			_init_err("case sampling requires a dataset and the built-in evaluator");
+		if (conf.dataset->_stream != NULL || conf.dataset->_window)
+			_init_err("case sampling requires a fixed in-memory dataset");
+		if (conf.sample_size == 0)
+			_init_err("sample_size must be greater than 0");
+		if (conf.sample_mode == GP_SAMPLE_PREDICTORS && (conf.num_predictors < 2 || conf.num_trainers < 2))
+			_init_err("fitness predictors need at least 2 predictors and 2 trainers");
+	}
+
+	if (conf.selection != GP_SELECT_TOURNAMENT) {
+		if (conf.evaluator != NULL || conf.batch_evaluator != NULL || conf.dataset == NULL)
+			_init_err("lexicase selection requires a dataset and the built-in evaluator");
+		if (conf.dataset->_stream != NULL || conf.sample_mode != GP_SAMPLE_ALL)
+			_init_err("lexicase selection requires an in-memory dataset without case sampling");
+	}
+
+	if (conf.screen_cases > 0) {
+		if (conf.evaluator != NULL || conf.batch_evaluator != NULL || conf.dataset == NULL)
+			_init_err("screening requires a dataset and the built-in evaluator");
+		if (conf.dataset->_stream != NULL || conf.dataset->_window)
+			_init_err("screening requires a fixed in-memory dataset");
+		if (conf.sample_mode != GP_SAMPLE_ALL || conf.selection != GP_SELECT_TOURNAMENT)
+			_init_err("screening cannot be combined with case sampling or lexicase selection");
+	}
+
+	if (conf.tournament_batch != 1 && conf.selection != GP_SELECT_TOURNAMENT)
+		_init_err("batched tournaments cannot be combined with lexicase selection");
+
+	if (conf.algorithm == GP_GENERATIONAL) {
+		if ((conf.num_elites & 1) != 0 || conf.num_elites >= conf.population_size)
+			_init_err("num_elites must be an even number smaller than population_size");
+		if (conf.screen_cases > 0)
+			_init_err("screening cannot be combined with the generational algorithm");
+	}
+
+	if (conf.algorithm == GP_CELLULAR) {
+		if (conf.selection != GP_SELECT_TOURNAMENT)
+			_init_err("the cellular algorithm selects by local tournaments, not lexicase");
+		if (conf.grid_width > 0 && conf.population_size % conf.grid_width != 0)
+			_init_err("grid_width must divide population_size");
+		const uint width = gp_topology_width(conf.population_size, conf.grid_width);
+		const uint side = conf.neighborhood_radius * 2 + 1;
+		if (conf.neighborhood_radius == 0 || side > width || side > conf.population_size / width)
+			_init_err("neighborhood_radius must be at least 1 and fit in the grid");
+	}
+
+	// Offspring are scored on several threads at once, and join the
+	// population without passing through the case caches
+	if (conf.algorithm == GP_ASYNC) {
+		if (conf.selection != GP_SELECT_TOURNAMENT || conf.sample_mode != GP_SAMPLE_ALL || conf.screen_cases > 0)
+			_init_err("the asynchronous algorithm cannot be combined with lexicase selection, case sampling or screening");
+		if (conf.dataset != NULL && (conf.dataset->_stream != NULL || conf.dataset->_window))
+			_init_err("the asynchronous algorithm requires a fixed in-memory dataset");
+	}
+
+	// Worker processes and evaluator nodes only see the world's config and
+	// data as they were at the start, so nothing the evaluation depends on
+	// may change afterwards
+	if (conf.num_processes > 0 || conf.farm_workers != NULL) {
+		if (conf.num_processes > 0 && conf.farm_workers != NULL)
+			_init_err("num_processes belongs on the evaluator nodes of a farm, not with farm_workers");
+		if (conf.batch_evaluator != NULL)
+			_init_err("num_processes and farm_workers cannot be combined with batch_evaluator");
+		if (conf.num_ops > GP_ENCODE_MAX_OPS || conf.num_inputs > GP_ENCODE_MAX_INPUTS)
+			_init_err("num_processes and farm_workers allow at most 256 ops and 65536 inputs");
+		if (conf.selection != GP_SELECT_TOURNAMENT || conf.sample_mode != GP_SAMPLE_ALL || conf.screen_cases > 0)
+			_init_err("num_processes and farm_workers cannot be combined with lexicase selection, case sampling or screening");
+		if (conf.dataset != NULL && (conf.dataset->_stream != NULL || conf.dataset->_window))
+			_init_err("num_processes and farm_workers require a fixed in-memory dataset");
+		if (!(conf.eval_timeout >= 0))
+			_init_err("eval_timeout cannot be negative");
+		if (conf.farm_workers != NULL && (conf.farm_workers[0] == '\0' || conf.farm_window == 0))
+			_init_err("farm_workers must list an address and farm_window be at least 1");
+	}
+
+	// Lazily scored programs have no fitness until they are drawn, so
+	// nothing else may read it in the meantime
+	if (conf.lazy_evaluation) {
+		if (conf.algorithm != GP_STEADY_STATE && conf.algorithm != GP_GENERATIONAL)
+			_init_err("lazy_evaluation requires the steady-state or generational algorithm");
+		if (conf.selection != GP_SELECT_TOURNAMENT || conf.screen_cases > 0)
+			_init_err("lazy_evaluation cannot be combined with lexicase selection or screening");
+		if (conf.dataset != NULL && (conf.dataset->_stream != NULL || conf.dataset->_window))
+			_init_err("lazy_evaluation requires a fixed in-memory dataset");
+	}
+
+	// Predicted scores stand in for real ones the way screening scores do,
+	// so the surrogate goes wherever screening can, but not with it
+	if (conf.surrogate_neighbors > 0) {
+		if (conf.algorithm == GP_GENERATIONAL || conf.algorithm == GP_ASYNC)
+			_init_err("the surrogate cannot be combined with the generational or asynchronous algorithm");
+		if (conf.selection != GP_SELECT_TOURNAMENT || conf.sample_mode != GP_SAMPLE_ALL)
+			_init_err("the surrogate cannot be combined with lexicase selection or case sampling");
+		if (conf.screen_cases > 0 || conf.lazy_evaluation || conf.eval_batch_size > 0)
+			_init_err("the surrogate cannot be combined with screening, lazy_evaluation or eval_batch_size");
+		if (conf.dataset != NULL && (conf.dataset->_stream != NULL || conf.dataset->_window))
+			_init_err("the surrogate requires a fixed in-memory dataset");
+		if (conf.surrogate_memory < conf.surrogate_neighbors)
+			_init_err("surrogate_memory cannot be less than surrogate_neighbors");
+		if (!(conf.surrogate_explore >= 0 && conf.surrogate_explore <= 1))
+			_init_err("surrogate_explore must be between 0 and 1");
+	}
+
+	// Until the initial population is scored, steady-state tournaments
+	// draw only from the programs scored so far
+	if (conf.background_init) {
+		if (conf.algorithm != GP_STEADY_STATE)
+			_init_err("background_init requires the steady-state algorithm");
+		if (conf.selection != GP_SELECT_TOURNAMENT || conf.sample_mode != GP_SAMPLE_ALL)
+			_init_err("background_init cannot be combined with lexicase selection or case sampling");
+		if (conf.lazy_evaluation || conf.eval_batch_size > 0)
+			_init_err("background_init cannot be combined with lazy_evaluation or eval_batch_size");
+		if (conf.dataset != NULL && (conf.dataset->_stream != NULL || conf.dataset->_window))
+			_init_err("background_init requires a fixed in-memory dataset");
+	}
+
+	if (conf.numa != GP_NUMA_OFF && !(conf.numa_exchange >= 0 && conf.numa_exchange <= 1))
+		_init_err("numa_exchange must be between 0 and 1");
+
+	// A batch evaluator also scores single programs, unless there is an
+	// evaluator for those
+	if (conf.evaluator == NULL)
+		conf.evaluator = conf.batch_evaluator != NULL ? &gp_batch_evaluate_one : &gp_dataset_evaluate;
+
+	// The built-in evaluator scores by error, and case sampling, lexicase,
+	// screening and split evaluation all take smaller as better
+	if (conf.evaluator == &gp_dataset_evaluate && !conf.minimize_fitness)
+		_init_err("the built-in evaluator requires minimize_fitness");
 
 	world->conf = conf;
 	world->has_init = 1;
 
+	// Fork the evaluator processes before the population makes the world
+	// expensive to copy, or connect to the farm's evaluator nodes
+	if (conf.num_processes > 0)
+		gp_procs_init(world);
+	else if (conf.farm_workers != NULL)
+		gp_farm_init(world);
+
+	// Without an explicit seed, draw one from the current generator so
+	// that worlds created together still differ.
+	gp_rand_seed(&world->_rand, conf.seed != 0 ? conf.seed : gp_rand_next(_gp_rng), conf.rand_mode);
+	gp_world_use_rand(world);
+
 	world->programs = new_array(GpProgram, world->conf.population_size);
 
 	int bufsize = conf.population_size * conf.max_program_length;
-	world->_stmt_buf = new_array(GpStatement, bufsize);
+	if (conf.numa != GP_NUMA_OFF)
+	{
+		// Each node's statement blocks go in its own memory before the
+		// programs are written, and every node shares the dataset
+		world->_numa_nodes = umin(gp_numa_num_nodes(), conf.population_size);
+		world->_stmt_buf = gp_numa_alloc(bufsize * sizeof(GpStatement));
+		gp_numa_place(world, world->_stmt_buf, conf.max_program_length * sizeof(GpStatement));
+		if (conf.dataset != NULL && conf.dataset->rows != NULL)
+			gp_numa_interleave(conf.dataset->rows,
+				(size_t)conf.dataset->capacity * (conf.num_inputs + 1) * sizeof(gp_num_t));
+	}
+	else
+		world->_stmt_buf = new_array(GpStatement, bufsize);
+
+	// A `tournament_batch` of 0 picks batches as large as fits their
+	// offspring in L1
+	if (conf.tournament_batch == 0)
+		conf.tournament_batch = GP_BATCH_CACHE_BYTES
+			/ (2 * conf.max_program_length * sizeof(GpStatement));
+	world->_batch.size = gp_max(umin(conf.tournament_batch, conf.population_size / 16), 1);
+	world->conf.tournament_batch = world->_batch.size;
+	if (world->_batch.size > 1)
+	{
+		world->_batch.progs = new_array(GpProgram *, world->_batch.size * 4);
+		// Room for the programs drawn, which lazy scoring lists here
+		world->_batch.children = new_array(GpProgram *, world->_batch.size * 4);
+		world->_batch.thresholds = new_array(gp_fitness_t, world->_batch.size * 2);
+		world->_batch.marks = new_array(uint, conf.population_size);
+		world->_batch.stamp = (uint)-1;
+	}
 
-	uint i, j;
-	for (i = 0; i < world->conf.population_size; i++) {
-		GpProgram * program = world->programs + i;
-		program->evaluated = 0;
-		program->stmts = world->_stmt_buf + i * conf.max_program_length;
-		program->num_stmts = urand(world->conf.min_program_length,
-			world->conf.max_program_length + 1);
-		for (j = 0; j < program->num_stmts; j++)
-			program->stmts[j] = gp_statement_random(world);
+	// Counter mode gives each program a stream of its own, so the programs
+	// can be written on the pool below. In SFMT mode they are written here,
+	// in order, from the world's engine, so that the population is the one
+	// earlier versions made from the same seed.
+	const uint num_blocks = (conf.population_size + GP_INIT_BLOCK - 1) / GP_INIT_BLOCK;
+	const int serial_init = world->_rand.mode == GP_RAND_SFMT;
+	uint i;
+	if (serial_init)
+		for (i = 0; i < num_blocks; i++)
+			_init_block(world, i);
+
+	// Whole generations, grid sweeps, batches of offspring and the cases
+	// of long programs on large datasets are scored on a pool of worker
+	// threads, which also optimizes and scores the initial population. With
+	// `parallel_init`, a pool is started for that alone, and stopped once
+	// the population is scored. Its engines are seeded from a copy of the
+	// world's, so the run goes on as it would without.
+	const uint num_threads = gp_pool_size(conf.num_threads);
+	const uint num_nodes = conf.numa != GP_NUMA_OFF ? world->_numa_nodes : 0;
+	const int may_split = conf.split_threshold > 0 && world->conf.evaluator == &gp_dataset_evaluate
+		&& conf.dataset->_stream == NULL
+		&& (ulong)conf.dataset->capacity * conf.max_program_length >= conf.split_threshold;
+	const int keep_pool = conf.algorithm == GP_GENERATIONAL
+		|| conf.algorithm == GP_CELLULAR || world->_batch.size > 1 || may_split;
+	if (num_threads > 1 && keep_pool)
+		world->_pool = gp_pool_new(num_threads, num_nodes, &world->_rand);
+	else if (num_threads > 1 && conf.parallel_init) {
+		GpRand pool_rng = world->_rand;
+		world->_pool = gp_pool_new(num_threads, num_nodes, &pool_rng);
 	}
 
+	if (!serial_init && world->_pool != NULL)
+		gp_pool_run(world->_pool, &_init_block, world, num_blocks);
+	else if (!serial_init)
+		for (i = 0; i < num_blocks; i++)
+			_init_block(world, i);
+
 	if (world->conf.auto_optimize)
 		gp_world_optimize(world);
 
-	for (i = 0; i < world->conf.population_size; i++) {
-		world->programs[i].fitness = world->conf.evaluator(world, world->programs + i);
-		world->programs[i].evaluated = 1;
+	// Programs evolving against a window keep their error on every case,
+	// so the window can slide without rerunning them. Lexicase selection
+	// needs the same errors to filter on.
+	if (conf.dataset != NULL && world->conf.evaluator == &gp_dataset_evaluate
+		&& (conf.dataset->_window || conf.selection != GP_SELECT_TOURNAMENT))
+	{
+		world->_case_errors = new_array(float, (size_t)conf.dataset->capacity * conf.population_size);
+		world->_error_totals = new_array(gp_fitness_t, conf.population_size);
+	}
+
+	if (conf.selection != GP_SELECT_TOURNAMENT)
+	{
+		const uint capacity = conf.dataset->capacity;
+		world->_lexicase.cases = new_array(uint, capacity);
+		world->_lexicase.num_cases = 0;
+		world->_lexicase.candidates = new_array(uint, conf.population_size);
+		world->_lexicase.survivors = new_array(uint, conf.population_size);
+		world->_lexicase.values = new_array(float, conf.population_size);
+		world->_lexicase.epsilon = new_array(float, capacity);
+		world->_lexicase.epsilon_step = 0;
+		for (i = 0; i < capacity; i++)
+			world->_lexicase.epsilon[i] = 0;
+		world->_id_slots = new_array(uint, conf.population_size);
+		for (i = 0; i < conf.population_size; i++)
+			world->_id_slots[i] = i;
+	}
+
+	if (conf.screen_cases > 0)
+		gp_screen_init(world);
+	else if (conf.surrogate_neighbors > 0)
+		gp_surrogate_init(world);
+
+	if (conf.algorithm == GP_GENERATIONAL)
+	{
+		world->_next.programs = new_array(GpProgram, conf.population_size);
+		world->_next.stmt_buf = new_array(GpStatement, bufsize);
+		world->_next.children = new_array(GpProgram *, conf.population_size);
+		world->_next.ids = new_array(uint, conf.population_size);
+		if (conf.lazy_evaluation)
+			world->_next.drawn = new_array(GpProgram *, conf.population_size * 2);
+		for (i = 0; i < conf.population_size; i++) {
+			world->_next.programs[i].stmts = world->_next.stmt_buf + i * conf.max_program_length;
+			world->_next.programs[i]._busy = 0;
+		}
+	}
+
+	if (conf.algorithm == GP_CELLULAR)
+		gp_world_cells_init(world);
+
+	// Workers draw from their node's ids, which sorting leaves in place
+	if (conf.numa != GP_NUMA_OFF && world->_id_slots == NULL) {
+		world->_id_slots = new_array(uint, conf.population_size);
+		for (i = 0; i < conf.population_size; i++)
+			world->_id_slots[world->programs[i].id] = i;
+	}
+
+	if (conf.sample_mode != GP_SAMPLE_ALL)
+	{
+		const uint num_cases = conf.dataset->num_cases;
+		world->conf.sample_size = umin(conf.sample_size, num_cases);
+		if (conf.sample_interval == 0)
+			world->conf.sample_interval = conf.population_size / 2;
+
+		world->_sample.size = world->conf.sample_size;
+		world->_sample.cases = new_array(uint, world->_sample.size);
+		world->_sample.order = new_array(uint, num_cases);
+		world->_sample.difficulty = new_array(float, num_cases);
+		world->_sample.age = new_array(uint, num_cases);
+		world->_sample.next = num_cases;
+
+		for (i = 0; i < num_cases; i++) {
+			world->_sample.order[i] = i;
+			world->_sample.difficulty[i] = -1;
+			world->_sample.age[i] = 0;
+		}
+
+		if (conf.sample_mode == GP_SAMPLE_PREDICTORS)
+			gp_predictors_init(world);
+
+		// Drawing the first sample scores the initial population
+		gp_world_resample(world);
+	}
+	else if (conf.background_init)
+	{
+		gp_background_start(world, world->_pool != NULL && !keep_pool);
+	}
+	else
+	{
+		GpProgram ** all = new_array(GpProgram *, conf.population_size);
+		for (i = 0; i < world->conf.population_size; i++)
+			all[i] = world->programs + i;
+		gp_world_evaluate(world, all, conf.population_size);
+		delete(all);
+	}
+
+	// A pool started only for initialization is done with
+	if (world->_pool != NULL && !keep_pool && world->_background == NULL) {
+		gp_pool_delete(world->_pool);
+		world->_pool = NULL;
+	}
+
+	// Streaming a dataset from disk once per offspring would make every
+	// step disk-bound, so offspring are instead queued and scored together
+	// in chunk-major batches.
+	if (conf.dataset != NULL && conf.dataset->_stream != NULL
+		&& world->conf.evaluator == &gp_dataset_evaluate)
+	{
+		if (world->conf.eval_batch_size < 2 || world->conf.eval_batch_size > conf.population_size / 2)
+			world->conf.eval_batch_size = gp_max(conf.population_size / 4, 2);
+		world->_pending = new_array(GpProgram *, world->conf.eval_batch_size);
 	}
 }
 
@@ -225,57 +690,72 @@ void gp_cross_homologous(GpProgram * mom, GpProgram * dad, GpProgram * c1, GpPro
 		stmts2[i] = dad->stmts[i];
 }
 
-// `gp_world_evolve_steady_state` uses a steady-state evolutionary algorithm
-// that will only perform one "breeding" operation per step
-// Each call will replace two programs with new ones
-static void gp_world_evolve_steady_state(GpWorld * world)
+// Pick a random program to take part in a tournament. Programs still
+// queued for scoring are skipped; lazily evaluated ones are scored by the
+// tournament that draws them. While the initial population is scored in
+// the background, only the programs scored so far are drawn, from enough
+// of them to fill a batch of tournaments.
+static inline GpProgram * _random_program(GpWorld * world)
 {
-	const uint popsize = world->conf.population_size;
+	uint count = world->conf.population_size;
+	if (gp_unlikely(world->_background != NULL))
+		count = gp_background_scored(world, umin(world->_batch.size * 8, count));
+
+	GpProgram * program;
+	do
+		program = world->programs + urand(0, count);
+	while (gp_unlikely(!program->evaluated) && world->_pending != NULL);
+	return program;
+}
 
-	// selection by tournament: we pick 4 programs, the best two are mated and the offspring
-	// replace the worst 2.
-	GpProgram * progs[] = {
-		world->programs + urand(0, popsize),
-		world->programs + urand(0, popsize),
-		world->programs + urand(0, popsize),
-		world->programs + urand(0, popsize)
-	};
+// `gp_world_breed` sorts the four programs in `progs` and overwrites the
+// worst two with offspring of the best two, leaving them unscored, and
+// returns the fitness the offspring have to beat. If the worst two are the
+// same program, nothing is bred. Nor is anything bred if a program drawn
+// twice is both a parent and a loser, which ties in fitness allow, and
+// `progs[3]` is then set to `progs[2]`. Event counts go to `counters` instead of
+// `world->stats`, so that concurrent callers each keep their own.
+gp_fitness_t gp_world_breed(GpWorld * world, GpProgram ** progs, GpCounters * counters)
+{
+	gp_tournament_sort(world, progs);
 
-	// Fast sort for 4 elements.
-	// Note: calling min and max to swap elements may seem inefficient, but
-	// gcc will detect this sequence and use extremely fast conditional move
-	// instructions. If we try to optimize this, it will become much slower.
-	// see: http://stackoverflow.com/questions/2786899/
-
-#define min(x,y) (x->fitness < y->fitness ? x : y)
-#define max(x,y) (x->fitness < y->fitness ? y : x)
-
-	if (world->conf.minimize_fitness) {
-#define SWAP(x,y) {	GpProgram * tmp = min(progs[x], progs[y]); progs[y] = max(progs[x], progs[y]); progs[x] = tmp; }
-	SWAP(0, 1);
-	SWAP(2, 3);
-	SWAP(0, 2);
-	SWAP(1, 3);
-	SWAP(1, 2);
-#undef SWAP
-	} else {
-#define SWAP(x,y) { GpProgram * tmp = max(progs[x], progs[y]); progs[y] = min(progs[x], progs[y]); progs[x] = tmp; }
-	SWAP(0, 1);
-	SWAP(2, 3);
-	SWAP(0, 2);
-	SWAP(1, 3);
-	SWAP(1, 2);
-#undef SWAP
-	}
+	counters->steps++;
 
-#undef max
-#undef min
+	if (progs[2] == progs[3])
+		return 0;
 
-	world->stats.total_steps++;
+	// Offspring have to beat the worse loser to be an improvement
+	const gp_fitness_t screen_threshold = progs[3]->fitness;
 
-	if (progs[2] == progs[3])
-		return;
+	// The tournament still decides which programs are replaced, but with
+	// lexicase selection the parents come from the whole population.
+	if (world->conf.selection != GP_SELECT_TOURNAMENT)
+	{
+		for (uint i = 0; i < 2; i++) {
+			for (uint tries = 0; tries < 8; tries++) {
+				GpProgram * parent = gp_select_lexicase(world);
+				if (parent != progs[2] && parent != progs[3]) {
+					progs[i] = parent;
+					break;
+				}
+			}
+		}
+	}
 
+	// A parent can't be overwritten while its offspring are bred
+	if (progs[2] == progs[0] || progs[2] == progs[1] || progs[3] == progs[0] || progs[3] == progs[1]) {
+		progs[3] = progs[2];
+		return 0;
+	}
+
+	gp_world_vary(world, progs);
+	return screen_threshold;
+}
+
+// `gp_world_vary` overwrites `progs[2]` and `progs[3]` with offspring of
+// `progs[0]` and `progs[1]`, by crossover or copying, then mutation.
+void gp_world_vary(GpWorld * world, GpProgram ** progs)
+{
 	if (rand_double() < world->conf.crossover_rate)
 	{
 		if (rand_double() < world->conf.homologous_rate)
@@ -296,16 +776,198 @@ static void gp_world_evolve_steady_state(GpWorld * world)
 		gp_mutate(world, progs[2]);
 	if (rand_double() < world->conf.mutate_rate)
 		gp_mutate(world, progs[3]);
+}
+
+// `gp_world_tournament` runs one breeding step between the four programs
+// in `progs`: the best two are mated and the offspring replace the worst 2.
+void gp_world_tournament(GpWorld * world, GpProgram ** progs, GpCounters * counters)
+{
+	// With lazy evaluation, programs are first scored when drawn, and
+	// offspring are left for whichever tournament draws them next
+	if (world->conf.lazy_evaluation) {
+		GpProgram * unscored[4];
+		gp_world_evaluate_lazy(world, progs, 4, unscored);
+	}
+
+	const gp_fitness_t screen_threshold = gp_world_breed(world, progs, counters);
+
+	if (progs[2] == progs[3])
+		return;
 
-	progs[2]->fitness = world->conf.evaluator(world, progs[2]);
-	progs[3]->fitness = world->conf.evaluator(world, progs[3]);
+	if (world->conf.lazy_evaluation)
+		progs[2]->evaluated = progs[3]->evaluated = 0;
+	else if (world->_pending != NULL)
+	{
+		progs[2]->evaluated = progs[3]->evaluated = 0;
+		world->_pending[world->_num_pending++] = progs[2];
+		world->_pending[world->_num_pending++] = progs[3];
+		if (world->_num_pending + 2 > world->conf.eval_batch_size)
+			gp_world_flush_pending(world);
+	}
+	else if (world->_screen_rows != NULL)
+	{
+		const gp_fitness_t thresholds[] = { screen_threshold, screen_threshold };
+		counters->screened += gp_screen_evaluate(world, progs + 2, thresholds, 2);
+	}
+	else if (world->_surrogate != NULL)
+	{
+		const gp_fitness_t thresholds[] = { screen_threshold, screen_threshold };
+		counters->screened += gp_surrogate_evaluate(world, progs + 2, thresholds, 2);
+	}
+	else if (world->conf.batch_evaluator != NULL)
+		gp_world_evaluate(world, progs + 2, 2);
+	else
+	{
+		progs[2]->fitness = world->conf.evaluator(world, progs[2]);
+		progs[3]->fitness = world->conf.evaluator(world, progs[3]);
+		progs[2]->evaluated = progs[3]->evaluated = 1;
+	}
+}
 
-	if (world->conf.auto_optimize && world->stats.total_steps % 300000 == 0)
+//
+// Run `size` tournaments as one step. The tournaments are
+// drawn so that no program takes part in more than one of them, which
+// makes their order irrelevant, and all of their offspring are then
+// scored together with `gp_world_evaluate`. With lazy evaluation, the
+// programs drawn that are still unscored are scored together instead, and
+// the offspring are left for later batches.
+//
+static void _evolve_batch(GpWorld * world, uint step, uint size, GpCounters * counters)
+{
+	GpProgram ** children = world->_batch.children;
+	gp_fitness_t * thresholds = world->_batch.thresholds;
+	uint * marks = world->_batch.marks;
+	uint num_children = 0;
+	uint i, j;
+
+	// Marks at or above `first` belong to this batch
+	if (world->_batch.stamp > (uint)-1 - size) {
+		for (i = 0; i < world->conf.population_size; i++)
+			marks[i] = 0;
+		world->_batch.stamp = 0;
+	}
+	const uint first = world->_batch.stamp + 1;
+
+	for (i = 0; i < size; i++)
+	{
+		GpProgram ** progs = world->_batch.progs + i * 4;
+		const uint mark = ++world->_batch.stamp;
+
+		gp_rand_stream(_gp_rng, step + i, 0, GP_STREAM_SELECT);
+		for (j = 0; j < 4; j++) {
+			uint slot;
+			do {
+				progs[j] = _random_program(world);
+				slot = progs[j] - world->programs;
+			} while (marks[slot] >= first && marks[slot] != mark);
+			marks[slot] = mark;
+		}
+	}
+
+	if (world->conf.lazy_evaluation)
+		gp_world_evaluate_lazy(world, world->_batch.progs, size * 4, children);
+
+	for (i = 0; i < size; i++)
+	{
+		GpProgram ** progs = world->_batch.progs + i * 4;
+
+		gp_rand_stream(_gp_rng, step + i, 0, GP_STREAM_VARY);
+		const gp_fitness_t threshold = gp_world_breed(world, progs, counters);
+		if (progs[2] != progs[3]) {
+			children[num_children] = progs[2];
+			children[num_children + 1] = progs[3];
+			thresholds[num_children] = thresholds[num_children + 1] = threshold;
+			num_children += 2;
+		}
+	}
+
+	if (world->conf.lazy_evaluation)
+	{
+		for (i = 0; i < num_children; i++)
+			children[i]->evaluated = 0;
+	}
+	else if (world->_pending != NULL)
+	{
+		for (i = 0; i < num_children; i++) {
+			children[i]->evaluated = 0;
+			world->_pending[world->_num_pending++] = children[i];
+			if (world->_num_pending == world->conf.eval_batch_size)
+				gp_world_flush_pending(world);
+		}
+	}
+	else if (world->_screen_rows != NULL)
+	{
+		counters->screened += gp_screen_evaluate(world, children, thresholds, num_children);
+	}
+	else if (world->_surrogate != NULL)
+	{
+		counters->screened += gp_surrogate_evaluate(world, children, thresholds, num_children);
+	}
+	else
+	{
+		gp_world_evaluate(world, children, num_children);
+	}
+}
+
+// `gp_world_evolve_steady_state` uses a steady-state evolutionary algorithm
+// that will only perform one "breeding" operation per step (or, with
+// `tournament_batch` set, up to `max_steps` of them bred and scored
+// together). Each tournament will replace two programs with new ones
+static void gp_world_evolve_steady_state(GpWorld * world, uint max_steps)
+{
+	// In counter mode, the programs drawn and everything done to them
+	// depend only on the step number (see _parallel.c_)
+	const uint step = world->stats.total_steps;
+	GpCounters counters = { 0, 0 };
+
+	if (world->_batch.size > 1 && max_steps > 1)
+	{
+		_evolve_batch(world, step, umin(world->_batch.size, max_steps), &counters);
+	}
+	else
+	{
+		gp_rand_stream(_gp_rng, step, 0, GP_STREAM_SELECT);
+
+		// selection by tournament: we pick 4 random programs
+		GpProgram * progs[] = {
+			_random_program(world),
+			_random_program(world),
+			_random_program(world),
+			_random_program(world)
+		};
+
+		gp_rand_stream(_gp_rng, step, 0, GP_STREAM_VARY);
+		gp_world_tournament(world, progs, &counters);
+	}
+
+	world->stats.total_steps += counters.steps;
+	world->stats.total_screened += counters.screened;
+
+	if (world->conf.auto_optimize && world->stats.total_steps / 300000 != step / 300000)
 		gp_world_optimize(world);
+
+	if (world->_sample.cases != NULL
+		&& world->stats.total_steps / world->conf.sample_interval != step / world->conf.sample_interval)
+		gp_world_resample(world);
 }
 
+// Run one step of the configured algorithm, or one generation or sweep
+static inline void _evolve_step(GpWorld * world, uint max_steps)
+{
+	if (world->conf.algorithm == GP_GENERATIONAL)
+		gp_world_evolve_generation(world);
+	else if (world->conf.algorithm == GP_CELLULAR)
+		gp_world_evolve_cellular(world);
+	else
+		gp_world_evolve_steady_state(world, max_steps);
+}
+
+// How many of the best programs are rescored on the whole dataset when
+// fitness cases are being sampled
+#define GP_RESCORE_TOP 8
+
 // Sort programs based on their fitness
-static void _sort_programs(GpWorld * world)
+void gp_world_sort_programs(GpWorld * world)
 {
 	// This macro-style qsort avoids function calls and contains
 	// performance improvements over stdlib's qsort.
@@ -323,36 +985,98 @@ static void _sort_programs(GpWorld * world)
 
 #undef CMP_G
 #undef CMP_L
+
+	if (world->_id_slots != NULL)
+		for (uint i = 0; i < world->conf.population_size; i++)
+			world->_id_slots[world->programs[i].id] = i;
+}
+
+// Score every program that lazy evaluation has left unscored
+static void _evaluate_unscored(GpWorld * world)
+{
+	const uint popsize = world->conf.population_size;
+	GpProgram ** progs = new_array(GpProgram *, popsize * 2);
+
+	for (uint i = 0; i < popsize; i++)
+		progs[i] = world->programs + i;
+	gp_world_evaluate_lazy(world, progs, popsize, progs + popsize);
+
+	delete(progs);
 }
 
 //
 // Recalculates various statistics in world->stats and sorts
 // the program by their fitness in descending order
 //
-static void _process_stats(GpWorld * world)
+void gp_world_process_stats(GpWorld * world)
 {
 	gp_fitness_t total_fitness = 0.0;
 	int total_length = 0;
 
+	// Sorting moves programs around, so nothing may be left pending, and
+	// the stats cover every program
+	gp_background_finish(world);
+	gp_world_flush_pending(world);
+	if (world->conf.lazy_evaluation)
+		_evaluate_unscored(world);
+
 	for (uint i = 0; i < world->conf.population_size; i++) {
 		total_fitness += world->programs[i].fitness;
 		total_length  += world->programs[i].num_stmts;
 	}
 
-	_sort_programs(world);
+	gp_world_sort_programs(world);
+
+	// The best programs must always carry full-precision scores
+	if (world->_screen_rows != NULL || world->_surrogate != NULL)
+		while (gp_screen_confirm_top(world, GP_RESCORE_TOP))
+			gp_world_sort_programs(world);
+	if (world->_surrogate != NULL)
+		world->stats.surrogate_accuracy = gp_surrogate_accuracy(world);
 
 	world->stats.avg_fitness = total_fitness / (gp_fitness_t)world->conf.population_size;
 	world->stats.best_fitness = world->programs[0].fitness;
+
+	// Sample scores flatter the best programs, so report a full-dataset one
+	if (world->_sample.cases != NULL)
+		world->stats.best_fitness = gp_world_rescore_top(world, GP_RESCORE_TOP);
 	world->stats.total_generations = world->stats.total_steps * 2 / world->conf.population_size;
 	world->stats.avg_program_length = total_length / (float)world->conf.population_size;
 }
 
-// Evolve `times` steps
+// Run `times` steps, or for `nsecs` seconds if that is positive, leaving
+// the stats to the caller
+static void _run(GpWorld * world, uint times, float nsecs)
+{
+	gp_world_use_rand(world);
+
+	if (world->conf.algorithm == GP_PIPELINED && gp_world_evolve_pipelined(world, times, nsecs))
+		return;
+
+	if (world->conf.algorithm == GP_ASYNC) {
+		gp_world_evolve_async(world, times, nsecs);
+		return;
+	}
+
+	if (nsecs > 0) {
+		// Wall clock time: CPU time would run on while pool threads work
+		// and stand still while worker processes or evaluator nodes do
+		const double deadline = gp_now() + nsecs;
+		while (gp_now() < deadline)
+			_evolve_step(world, (uint)-1);
+	} else {
+		const uint target = world->stats.total_steps + times;
+		while (world->stats.total_steps < target)
+			_evolve_step(world, target - world->stats.total_steps);
+	}
+}
+
+// Evolve `times` steps. The generational algorithm rounds up to whole
+// generations of `population_size / 2` steps.
 void gp_world_evolve_times(GpWorld * world, uint times)
 {
-	while (times--)
-		gp_world_evolve_steady_state(world);
-	_process_stats(world);
+	_run(world, times, 0);
+	gp_world_process_stats(world);
 }
 
 // Evolve until `gens` generations have passed.
@@ -366,17 +1090,10 @@ void gp_world_evolve_gens(GpWorld * world, uint gens)
 // Returns the number of iterations taken.
 uint gp_world_evolve_secs(GpWorld * world, float nsecs)
 {
-	const clock_t nclocks = (clock_t)(nsecs * CLOCKS_PER_SEC);
-	clock_t start = clock();
-	uint times = 0;
-
-	while (clock() - start < nclocks)
-	{
-		gp_world_evolve_steady_state(world);
-		times++;
-	}
+	const uint steps_before = world->stats.total_steps;
 
-	_process_stats(world);
+	_run(world, 0, nsecs);
+	gp_world_process_stats(world);
 
-	return times;
+	return world->stats.total_steps - steps_before;
 }